@@ -24,6 +24,25 @@ YAPD_API void
 yapd_buffer_reserve(
     yapd_buffer_t* buf, int bytes);
 
+// Alignment in bytes of offsets of yapd_buffer_sub.
+YAPD_API int
+yapd_buffer_align(
+    yapd_gpu_t* gpu);
+
+// View of `bytes` of `buf` from `offset`, valid until `buf` is released.
+YAPD_API yapd_buffer_t
+yapd_buffer_sub(
+    yapd_buffer_t* buf, int offset, int bytes);
+
+YAPD_API void
+yapd_buffer_zero(
+    yapd_buffer_t* buf);
+
+// View of `buf` as tightly packed rows of `w` pixels of `channels` floats.
+YAPD_API yapd_buffer_view_t
+yapd_buffer_view(
+    yapd_buffer_t* buf, int w, int channels);
+
 YAPD_API void
 yapd_buffer_release(
     yapd_buffer_t* buf);
@@ -49,6 +68,14 @@ YAPD_API void
 yapd_buffer_luv_from_rgb8uc4(
     yapd_buffer_t* buf, yapd_buffer_t* rgb, const yapd_size_t* sz);
 
+// LUV of `rgb` resampled to `dst_sz` then smoothed by triangle filter,
+// without storing LUV image of the source size.
+YAPD_API void
+yapd_buffer_luv_smooth_rgb8uc4(
+    yapd_buffer_t* dst, yapd_buffer_t* tmp, const yapd_size_t* dst_sz,
+    yapd_buffer_t* rgb, const yapd_size_t* rgb_sz,
+    int r, yapd_buffer_t* filter);
+
 YAPD_API void
 yapd_tri_filter(
     yapd_alloc_t a, void* aud, int r, float** filter, int* bytes);
@@ -83,6 +110,12 @@ yapd_buffer_conv_tri32fc16(
     yapd_buffer_t* img, yapd_buffer_t* tmp,
     const yapd_size_t* sz, int r, yapd_buffer_t* filter);
 
+// compact feature cells of YAPD_FEATURE_COMPACT_CHANNELS floats.
+YAPD_API void
+yapd_buffer_conv_tri32fc10(
+    yapd_buffer_t* img, yapd_buffer_t* tmp,
+    const yapd_size_t* sz, int r, yapd_buffer_t* filter);
+
 YAPD_API void
 yapd_buffer_resample32f(
     yapd_buffer_t* dst, const yapd_size_t* dst_sz,
@@ -98,6 +131,28 @@ yapd_buffer_resample32fc8(
     yapd_buffer_t* dst, const yapd_size_t* dst_sz,
     yapd_buffer_t* src, const yapd_size_t* src_sz, float norm);
 
+// Same as above, but written into `dst` view.
+YAPD_API void
+yapd_buffer_resample32f_view(
+    const yapd_buffer_view_t* dst, const yapd_size_t* dst_sz,
+    yapd_buffer_t* src, const yapd_size_t* src_sz, float norm);
+
+YAPD_API void
+yapd_buffer_resample32fc4_view(
+    const yapd_buffer_view_t* dst, const yapd_size_t* dst_sz,
+    yapd_buffer_t* src, const yapd_size_t* src_sz, float norm);
+
+YAPD_API void
+yapd_buffer_resample32fc8_view(
+    const yapd_buffer_view_t* dst, const yapd_size_t* dst_sz,
+    yapd_buffer_t* src, const yapd_size_t* src_sz, float norm);
+
+// Bilinear with pixel centers aligned, 2x is exact 2x2 box average.
+YAPD_API void
+yapd_buffer_downsample32fc4(
+    yapd_buffer_t* dst, const yapd_size_t* dst_sz,
+    yapd_buffer_t* src, const yapd_size_t* src_sz);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
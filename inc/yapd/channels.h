@@ -31,6 +31,26 @@ yapd_channels_compute(
     yapd_buffer_t* tmp, yapd_buffer_t* color,
     yapd_buffer_t* mag, yapd_buffer_t* hist);
 
+// Same as `yapd_channels_compute` but starts from RGBA8 `rgb`, which is
+// converted and resampled into `img` (at prepared size) by a fused pass.
+YAPD_API void
+yapd_channels_compute_rgb8uc4(
+    yapd_channels_t* c, yapd_buffer_t* rgb, const yapd_size_t* rgb_sz,
+    yapd_buffer_t* img, yapd_buffer_t* tmp, yapd_buffer_t* color,
+    yapd_buffer_t* mag, yapd_buffer_t* hist);
+
+// Same as above, but written into views of `out` (which may be padded or
+// interleaved), so the outputs given to `yapd_channels_prepare` are unused.
+YAPD_API void
+yapd_channels_compute_view(
+    yapd_channels_t* c, yapd_buffer_t* img,
+    yapd_buffer_t* tmp, const yapd_channels_out_t* out);
+
+YAPD_API void
+yapd_channels_compute_rgb8uc4_view(
+    yapd_channels_t* c, yapd_buffer_t* rgb, const yapd_size_t* rgb_sz,
+    yapd_buffer_t* img, yapd_buffer_t* tmp, const yapd_channels_out_t* out);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
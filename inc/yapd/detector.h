@@ -23,12 +23,32 @@ yapd_detector_ready(
     return d->num_weaks > 0;
 }
 
+// Trees are split in stages at increasing `stages` ends, survivors of each
+// stage are compacted before the next one. The first stage is early
+// rejection of at most YAPD_DETECTOR_EARLY_WEAKS trees, the last ends at
+// num_weaks implicitly. NULL splits early rejection from the rest.
 YAPD_API void
 yapd_detector_classifier(
     yapd_detector_t* d, int copy,
     int num_weaks, int depth, int shrink,
     const yapd_size_t* win_sz, const yapd_size_t* org_win,
-    yapd_mat_t* thrs, yapd_mat_t* fids, yapd_mat_t* hs);
+    yapd_mat_t* thrs, yapd_mat_t* fids, yapd_mat_t* hs,
+    const int* stages, int num_stages);
+
+// Fixed capacity of proposals which pass early rejection, they are counted
+// on the device without a round trip to the host, capacity grows when a
+// frame overflows. 0 sizes proposals by their count every frame.
+YAPD_API void
+yapd_detector_capacity(
+    yapd_detector_t* d, int capacity);
+
+// Coarse-to-fine search, early rejection first runs on a grid `coarse`
+// times sparser than stride, then only windows closer than `coarse` steps
+// to a coarse window which scored above `thr` are evaluated. A looser `thr`
+// than casc_thr keeps recall. 0 or 1 evaluates all windows.
+YAPD_API void
+yapd_detector_coarse(
+    yapd_detector_t* d, int coarse, float thr);
 
 YAPD_API yapd_mat_t
 yapd_detector_predict(
@@ -8,12 +8,29 @@
 extern "C" {
 #endif
 
+YAPD_API const yapd_gpu_opts_t*
+yapd_gpu_default_opts();
+
+// Fills up to `max_infos` devices of all platforms, returns total count.
+// Index of an info selects its device with CL_DEVICE_TYPE_ALL, platform -1
+// and no vendor or name in yapd_gpu_opts_t.
+YAPD_API int
+yapd_gpu_query_devices(
+    yapd_gpu_device_info_t* infos, int max_infos);
+
+// Info of the selected device, FALSE if using the CPU backend.
+YAPD_API int
+yapd_gpu_device_info(
+    yapd_gpu_t* gpu, yapd_gpu_device_info_t* info);
+
 YAPD_API yapd_gpu_t
-yapd_gpu_new();
+yapd_gpu_new(
+    const yapd_gpu_opts_t* opts);
 
+// `options` are passed to clBuildProgram, could be NULL.
 YAPD_API cl_program
 yapd_gpu_load_program(
-    yapd_gpu_t* gpu, const char* source);
+    yapd_gpu_t* gpu, const char* source, const char* options);
 
 YAPD_API void
 yapd_gpu_sync(
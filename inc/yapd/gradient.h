@@ -8,6 +8,13 @@
 extern "C" {
 #endif
 
+// Entries of acos table over [-1, 1] for orientation lookup. Nearest entry
+// is within h/2 of the cosine where h = 2/(YAPD_ACOS_LUT_SIZE - 1), so the
+// angle error is below h/(2*sin(angle)), and at most sqrt(h) ~ 0.022 rad
+// (0.042 bins of 6 orientations) for gradients close to horizontal.
+#define YAPD_ACOS_LUT_SIZE 4097
+
+// `angle` may be NULL when only magnitude is needed.
 YAPD_API void
 yapd_gradient_mag32fc4(
     yapd_buffer_t* img, const yapd_size_t* sz,
@@ -27,6 +34,21 @@ yapd_gradient_hist(
     yapd_buffer_t* hist, yapd_buffer_t* mag, yapd_buffer_t* angle,
     const yapd_size_t* sz, int bin_size, int num_orients);
 
+YAPD_API void
+yapd_acos_lut(
+    yapd_alloc_t a, void* aud, float** lut, int* bytes);
+
+// Normalizes unnormalized `mag` in place and computes histogram of `sz`
+// cells in one pass, gradient angles are recomputed from smoothed `img`.
+// Angles are looked up in `acos_lut` (see yapd_acos_lut) instead of atan2
+// unless it's an empty buffer. Histogram is written into `hist` view.
+YAPD_API void
+yapd_gradient_norm_hist32fc4(
+    const yapd_buffer_view_t* hist, yapd_buffer_t* img, yapd_buffer_t* mag,
+    const yapd_size_t* sz, yapd_buffer_t* tmp, float norm_const,
+    int r, yapd_buffer_t* filter, int bin_size, int num_orients,
+    yapd_buffer_t* acos_lut);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
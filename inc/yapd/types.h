@@ -107,16 +107,37 @@ typedef struct yapd_mat_s {
     yapd_size_t size;
 } yapd_mat_t;
 
+typedef enum {
+    YAPD_BACKEND_AUTO,
+    YAPD_BACKEND_OPENCL,
+    YAPD_BACKEND_CPU
+} yapd_backend_t;
+
+// flag of buffers made by yapd_buffer_sub, they don't own their memory.
+#define YAPD_BUFFER_SUB (1 << 30)
+
 typedef struct yapd_buffer_s {
     struct yapd_gpu_s* gpu;
     int bytes;
     int flags;
     cl_mem mem;
+    uint8_t* host;
 } yapd_buffer_t;
 
+// pixels of `buf` in rows of `pitch` cells of `cell` floats, first pixel
+// is at cell `offset` and its channels start at float `lane` of cell.
+typedef struct yapd_buffer_view_s {
+    yapd_buffer_t* buf;
+    int pitch;
+    int offset;
+    int cell;
+    int lane;
+} yapd_buffer_view_t;
+
 typedef struct yapd_gpu_color_ctx_s {
     cl_program program;
     cl_kernel luv_from_rgb8uc4;
+    cl_kernel luv_smooth_cols_rgb8uc4;
     yapd_buffer_t ltable;
 } yapd_gpu_color_ctx_t;
 
@@ -125,6 +146,7 @@ typedef struct yapd_gpu_resample_ctx_s {
     cl_kernel resample32f;
     cl_kernel resample32fc4;
     cl_kernel resample32fc8;
+    cl_kernel downsample32fc4;
 } yapd_gpu_resample_ctx_t;
 
 typedef struct yapd_gpu_convolution_ctx_s {
@@ -135,21 +157,70 @@ typedef struct yapd_gpu_convolution_ctx_s {
     cl_kernel conv_tri32fc4;
     cl_kernel conv_tri32fc8;
     cl_kernel conv_tri32fc16;
+    cl_kernel conv_tri32fc10;
+    cl_kernel conv_tri_sum32f;
+    int sum_radius;
+    // local memory tiled variants
+    int tiled;
+    cl_ulong local_mem;
+    cl_kernel conv_tri_cols32f_tiled;
+    cl_kernel conv_tri_rows32f_tiled;
+    cl_kernel conv_tri32f_tiled;
+    cl_kernel conv_tri32fc4_tiled;
+    cl_kernel conv_tri32fc8_tiled;
+    cl_kernel conv_tri32fc16_tiled;
 } yapd_gpu_convolution_ctx_t;
 
+// number of specialized variants per kernel, built on demand with -D
+// constants, generic kernel is used once exhausted.
+enum { YAPD_GPU_MAX_VARIANTS = 8 };
+
+typedef struct yapd_gpu_hist_variant_s {
+    int bin_size;
+    int num_orients;
+    cl_program program;
+    cl_kernel grad_hist;
+    cl_kernel grad_norm_hist32fc4;
+} yapd_gpu_hist_variant_t;
+
 typedef struct yapd_gpu_gradient_ctx_s {
     cl_program program;
     cl_kernel grad_mag32fc4;
     cl_kernel grad_mag_norm;
     cl_kernel grad_scale_angle;
     cl_kernel grad_hist;
+    cl_kernel grad_norm_hist32fc4;
+    int num_variants;
+    yapd_gpu_hist_variant_t variants[YAPD_GPU_MAX_VARIANTS];
 } yapd_gpu_gradient_ctx_t;
 
+typedef struct yapd_gpu_conpad_variant_s {
+    yapd_size_t pad;
+    int compact;
+    int storage;
+    cl_program program;
+    cl_kernel pyramid_border;
+    cl_kernel pyramid_approx;
+    cl_kernel pyramid_smooth_cols;
+    cl_kernel pyramid_smooth_rows;
+} yapd_gpu_conpad_variant_t;
+
 typedef struct yapd_gpu_pyramid_ctx_s {
     cl_program program;
-    cl_kernel pyramid_conpad;
+    cl_kernel pyramid_border;
+    cl_kernel pyramid_approx;
+    int num_variants;
+    yapd_gpu_conpad_variant_t variants[YAPD_GPU_MAX_VARIANTS];
 } yapd_gpu_pyramid_ctx_t;
 
+typedef struct yapd_gpu_detector_variant_s {
+    int depth;
+    cl_program program;
+    cl_kernel early_reject;
+    cl_kernel early_reject_tiled;
+    cl_kernel predict;
+} yapd_gpu_detector_variant_t;
+
 typedef struct yapd_gpu_detector_ctx_s {
     cl_program program;
     cl_kernel early_reject;
@@ -157,10 +228,75 @@ typedef struct yapd_gpu_detector_ctx_s {
     cl_kernel early_prefix_sum;
     cl_kernel early_bbs;
     cl_kernel predict;
-    cl_kernel predict_sum;
+    // compaction of boxes between stages of the cascade
+    cl_kernel stage_flags;
+    cl_kernel stage_bbs;
+    // early rejection with feature tiles in local memory
+    int tiled;
+    cl_ulong local_mem;
+    cl_kernel early_reject_tiled;
+    // persistent work-groups of predict are per compute unit
+    cl_uint compute_units;
+    int num_variants;
+    yapd_gpu_detector_variant_t variants[YAPD_GPU_MAX_VARIANTS];
 } yapd_gpu_detector_ctx_t;
 
+typedef struct yapd_gpu_cpu_ctx_s {
+    int num_threads;
+} yapd_gpu_cpu_ctx_t;
+
+typedef struct yapd_gpu_opts_s {
+    // AUTO prefers OpenCL, falls back to native CPU if no device found.
+    yapd_backend_t backend;
+    // worker threads of CPU backend, 0 to use all cores.
+    int num_threads;
+    // OpenCL device selection, a device must match all criteria.
+    struct device_s {
+        cl_device_type type;
+        // platform index, -1 for any platform.
+        int platform;
+        // case sensitive substrings of vendor and name, NULL for any.
+        const char* vendor;
+        const char* name;
+        // picks n-th matched device.
+        int index;
+    } device;
+    // existing directory to cache program binaries, NULL to disable.
+    const char* cache_dir;
+    // triangle filters of this radius or larger are computed as running
+    // box sums, that costs the same for any radius, 0 to disable. Off by
+    // default, so that default radii keep the tiled filter.
+    int tri_sum_radius;
+} yapd_gpu_opts_t;
+
+enum {
+    YAPD_GPU_INFO_NAME = 128,
+    YAPD_GPU_INFO_EXTENSIONS = 2048
+};
+
+typedef struct yapd_gpu_device_info_s {
+    int platform;
+    // among devices of all platforms, see yapd_gpu_query_devices
+    int index;
+    cl_device_type type;
+    char platform_name[YAPD_GPU_INFO_NAME];
+    char name[YAPD_GPU_INFO_NAME];
+    char vendor[YAPD_GPU_INFO_NAME];
+    char version[YAPD_GPU_INFO_NAME];
+    int compute_units;
+    int max_clock_mhz;
+    int max_work_group_size;
+    uint64_t global_mem;
+    uint64_t local_mem;
+    char extensions[YAPD_GPU_INFO_EXTENSIONS];
+} yapd_gpu_device_info_t;
+
+enum { YAPD_GPU_CACHE_PATH = 512 };
+
 typedef struct yapd_gpu_s {
+    yapd_backend_t backend;
+    yapd_gpu_cpu_ctx_t cpu;
+    char cache_dir[YAPD_GPU_CACHE_PATH];
     cl_context ctx;
     cl_command_queue queue;
     cl_device_id dev_ids[1];
@@ -184,9 +320,17 @@ typedef struct yapd_channels_opts_s {
     struct grad_hist_s {
         int bin_size;
         int num_orients;
+        int orient_lut; // acos table instead of atan2
     } grad_hist;
 } yapd_channels_opts_t;
 
+// destinations of color, gradient magnitude and histogram channels.
+typedef struct yapd_channels_out_s {
+    yapd_buffer_view_t color;
+    yapd_buffer_view_t mag;
+    yapd_buffer_view_t hist;
+} yapd_channels_out_t;
+
 typedef struct yapd_channels_s {
     yapd_alloc_t a;
     void* aud;
@@ -196,18 +340,41 @@ typedef struct yapd_channels_s {
     yapd_buffer_t smooth_filter;
     float* mag_norm_filter_host;
     yapd_buffer_t mag_norm_filter;
+    float* acos_lut_host;
+    yapd_buffer_t acos_lut;
     yapd_size_t capacity;
     yapd_size_t crop_sz;
     yapd_size_t hist_sz;
     yapd_size_t data_sz;
     yapd_buffer_t mag;
-    yapd_buffer_t angle;
     yapd_buffer_t hist;
 } yapd_channels_t;
 
 typedef cl_float16 yapd_feature_t;
 enum { YAPD_FEATURE_CHANNELS = sizeof(yapd_feature_t) / sizeof(float) };
 
+// floats of compact feature cell, LUV, magnitude and 6 orientations.
+enum { YAPD_FEATURE_COMPACT_CHANNELS = 10 };
+
+// storage of features in pyramid slots, same values as FEATURE_* of
+// detector.cl, arithmetic is float either way. U8 features are quantized
+// by channel scales of yapd_pyramid_opts_t.quant.
+typedef enum yapd_feature_storage_e {
+    YAPD_FEATURE_FLOAT = 0,
+    YAPD_FEATURE_HALF = 1,
+    YAPD_FEATURE_U8 = 2
+} yapd_feature_storage_t;
+
+// approximated levels written by single pyramid_approx launch.
+#define YAPD_PYRAMID_MAX_APPROX_LAUNCH 8
+
+// approximated pyramid level, same layout as level_t of pyramid.cl.
+typedef struct yapd_pyramid_level_s {
+    cl_float4 ratio; // color, magnitude, histogram power law ratio
+    cl_int2 sz; // data size
+    cl_int2 src_sz; // data size of real scale
+} yapd_pyramid_level_t;
+
 typedef struct yapd_pyramid_opts_s {
     yapd_size_t pad;
     yapd_size_t min_ds;
@@ -215,6 +382,18 @@ typedef struct yapd_pyramid_opts_s {
     int per_oct;
     int oct_up;
     int smooth;
+    // real scales from previous real scale instead of source pixels,
+    // meant for num_approx = per_oct - 1 (real scales an octave apart).
+    int cascade;
+    // features packed as YAPD_FEATURE_COMPACT_CHANNELS floats per cell
+    // instead of yapd_feature_t, requires 6 orientations.
+    int compact;
+    // features stored as half floats or bytes, channels are computed in
+    // float either way.
+    yapd_feature_storage_t storage;
+    // bytes per unit of color, magnitude and histogram channels stored as
+    // YAPD_FEATURE_U8, saturated at 255.
+    float quant[3];
 } yapd_pyramid_opts_t;
 
 typedef struct yapd_pyramid_s {
@@ -223,6 +402,8 @@ typedef struct yapd_pyramid_s {
     yapd_gpu_t* gpu;
     yapd_channels_t* channels;
     yapd_pyramid_opts_t opts;
+    // floats per feature cell
+    int cell;
     float* smooth_filter_host;
     yapd_buffer_t smooth_filter;
     yapd_size_t last_sz;
@@ -233,18 +414,44 @@ typedef struct yapd_pyramid_s {
     float* scalesw;
     float* scalesh;
     yapd_size_t* data_sz;
+    // slots of all scales are views of `slots` at byte offsets `slot_off`
+    int* slot_off;
     yapd_buffer_t* data;
+    yapd_buffer_t slots;
     yapd_buffer_t tmp;
     yapd_buffer_t img;
-    yapd_buffer_t small;
-    yapd_buffer_t color;
-    yapd_buffer_t mag;
-    yapd_buffer_t hist;
-    yapd_buffer_t apx_color;
-    yapd_buffer_t apx_mag;
-    yapd_buffer_t apx_hist;
+    yapd_buffer_t base;
+    yapd_buffer_t rgb;
+    // float cells of real scale when slots aren't float, packed by border
+    yapd_buffer_t work;
+    yapd_pyramid_level_t* levels_host;
+    yapd_buffer_t levels;
 } yapd_pyramid_t;
 
+// tree node of packed classifier, same layout as node_t of detector.cl, a
+// single load per node instead of separate thresholds, fids and leaves.
+typedef struct yapd_detector_node_s {
+    // row of window in high 16 bits, cell float of the row in low 16 bits
+    cl_int fid;
+    cl_float thr;
+    cl_int qthr; // quantized threshold for YAPD_FEATURE_U8
+    cl_float h; // leaf value
+} yapd_detector_node_t;
+
+// pyramid scale as seen by the detector, same layout as scale_t of
+// detector.cl, so that each phase covers all scales by a single launch.
+typedef struct yapd_detector_scale_s {
+    cl_int chns_off; // first feature of the slot in pyramid slots
+    cl_int org_w; // slot size
+    cl_int org_h;
+    cl_int out_w; // windows
+    cl_int out_h;
+    cl_int out_off; // first window
+    cl_int group_off; // first work-group of tiled early rejection
+} yapd_detector_scale_t;
+
+enum { YAPD_DETECTOR_MAX_STAGES = 8 };
+
 typedef struct yapd_detector_s {
     yapd_alloc_t a;
     void* aud;
@@ -252,27 +459,59 @@ typedef struct yapd_detector_s {
     int dirty;
     int num_weaks;
     int depth;
+    // end of trees of each stage, the first is early rejection and the
+    // last is num_weaks, survivors are compacted between stages
+    int num_stages;
+    int stages[YAPD_DETECTOR_MAX_STAGES];
+    // specialized for depth of current classifier
+    cl_kernel early_reject;
+    cl_kernel early_reject_tiled;
+    cl_kernel predict;
     yapd_size_t win_sz;
     yapd_size_t org_win;
     int shrink;
     yapd_mat_t thrs_host;
     yapd_mat_t fids_host;
     yapd_mat_t hs_host;
-    yapd_buffer_t thrs;
-    yapd_buffer_t fids;
-    yapd_buffer_t hs;
+    // floats per feature cell of pyramid, fids are remapped to it
+    int cell;
+    // storage of pyramid features, thresholds are quantized for U8
+    yapd_feature_storage_t storage;
+    // packed nodes of at least YAPD_DETECTOR_EARLY_WEAKS trees, trees
+    // past num_weaks are zero
+    yapd_detector_node_t* nodes_host;
+    yapd_buffer_t nodes;
+    // scales of the last pyramid followed by a sentinel of totals
     int num_scales;
-    yapd_size_t* sizes;
-    int** cids_host;
-    yapd_buffer_t* cids;
-    yapd_buffer_t dsz;
+    yapd_detector_scale_t* scales_host;
+    yapd_buffer_t scales;
     yapd_buffer_t out;
+    // rank of surviving windows in their scan block, first survivor of
+    // blocks and number of survivors of each stage
     yapd_buffer_t idx;
-    yapd_buffer_t len;
-    yapd_buffer_t sum;
+    yapd_buffer_t blocks;
+    yapd_buffer_t count;
+    // next proposal pulled by persistent work-groups of predict
+    yapd_buffer_t queue;
+    // fixed number of proposals, 0 if sized by count every frame
+    int capacity;
+    // early rejection first runs on a grid `coarse` times sparser than
+    // stride, 0 if all windows are evaluated at once
+    int coarse;
+    float coarse_thr;
+    int num_coarse_scales;
+    yapd_detector_scale_t* coarse_scales_host;
+    yapd_buffer_t coarse_scales;
+    yapd_buffer_t coarse_out;
     yapd_buffer_t bbs;
-    yapd_buffer_t hss;
+    // survivors of odd stages when there are more than two, scans of their
+    // compaction are apart from idx and blocks, which a rerun of
+    // proposals on overflow reads again
+    yapd_buffer_t stage_bbs;
+    yapd_buffer_t stage_idx;
+    yapd_buffer_t stage_blocks;
     yapd_buffer_t tmp;
 } yapd_detector_t;
 
-enum { YAPD_DETECTOR_TREE_NODES = 8 };
\ No newline at end of file
+enum { YAPD_DETECTOR_TREE_NODES = 8 };
+enum { YAPD_DETECTOR_EARLY_WEAKS = 32 };
\ No newline at end of file
@@ -10,11 +10,16 @@ buffer_create(
     b.gpu = gpu;
     b.bytes = bytes;
     b.flags = flags;
+    b.mem = 0;
+    b.host = NULL;
     if (bytes > 0) {
-        b.mem = clCreateBuffer(gpu->ctx, flags, bytes, NULL, &err);
-        assert(err == CL_SUCCESS);
-    } else {
-        b.mem = 0;
+        if (gpu->backend == YAPD_BACKEND_CPU) {
+            b.host = (uint8_t*)malloc(bytes);
+            assert(b.host);
+        } else {
+            b.mem = clCreateBuffer(gpu->ctx, flags, bytes, NULL, &err);
+            assert(err == CL_SUCCESS);
+        }
     }
     return b;
 }
@@ -45,18 +50,94 @@ yapd_buffer_reserve(
     yapd_buffer_t* buf, int bytes)
 {
     if (buf->bytes < bytes) {
+        assert(!(buf->flags & YAPD_BUFFER_SUB));
         yapd_buffer_release(buf);
         *buf = buffer_create(buf->gpu, bytes, buf->flags);
     }
 }
 
+int
+yapd_buffer_align(
+    yapd_gpu_t* gpu)
+{
+    cl_int err;
+    cl_uint bits;
+    if (gpu->backend == YAPD_BACKEND_CPU) return 64;
+    err = clGetDeviceInfo(
+        gpu->dev_ids[0], CL_DEVICE_MEM_BASE_ADDR_ALIGN,
+        sizeof(bits), &bits, NULL);
+    assert(err == CL_SUCCESS);
+    return (int)bits / 8;
+}
+
+yapd_buffer_t
+yapd_buffer_sub(
+    yapd_buffer_t* buf, int offset, int bytes)
+{
+    cl_int err;
+    cl_buffer_region region;
+    yapd_buffer_t b;
+    assert(offset >= 0 && bytes > 0 && offset + bytes <= buf->bytes);
+    assert(offset % yapd_buffer_align(buf->gpu) == 0);
+    b.gpu = buf->gpu;
+    b.bytes = bytes;
+    b.flags = buf->flags | YAPD_BUFFER_SUB;
+    b.mem = 0;
+    b.host = NULL;
+    if (buf->host) {
+        b.host = buf->host + offset;
+        return b;
+    }
+    region.origin = offset;
+    region.size = bytes;
+    b.mem = clCreateSubBuffer(
+        buf->mem, 0, CL_BUFFER_CREATE_TYPE_REGION, &region, &err);
+    assert(err == CL_SUCCESS);
+    return b;
+}
+
+void
+yapd_buffer_zero(
+    yapd_buffer_t* buf)
+{
+    cl_int err;
+    const float zero = 0;
+    if (buf->bytes == 0) return;
+    if (buf->host) {
+        memset(buf->host, 0, buf->bytes);
+        return;
+    }
+    err = clEnqueueFillBuffer(
+        buf->gpu->queue, buf->mem, &zero, sizeof(zero),
+        0, buf->bytes, 0, NULL, NULL);
+    assert(err == CL_SUCCESS);
+}
+
+yapd_buffer_view_t
+yapd_buffer_view(
+    yapd_buffer_t* buf, int w, int channels)
+{
+    yapd_buffer_view_t v;
+    v.buf = buf;
+    v.pitch = w;
+    v.offset = 0;
+    v.cell = channels;
+    v.lane = 0;
+    return v;
+}
+
 void
 yapd_buffer_release(
     yapd_buffer_t* buf)
 {
     if (buf->gpu && buf->bytes > 0) {
-        clReleaseMemObject(buf->mem);
-        buf->mem = 0;
+        if (buf->host) {
+            if (!(buf->flags & YAPD_BUFFER_SUB)) free(buf->host);
+            buf->host = NULL;
+        } else {
+            clReleaseMemObject(buf->mem);
+            buf->mem = 0;
+        }
         buf->bytes = 0;
     }
 }
@@ -67,6 +148,10 @@ yapd_buffer_upload(
 {
     cl_int err;
     if (bytes == 0) return;
+    if (buf->host) {
+        memcpy(buf->host, data, bytes);
+        return;
+    }
     err = clEnqueueWriteBuffer(
         buf->gpu->queue, buf->mem, CL_FALSE, 0, bytes, data, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
@@ -82,6 +167,14 @@ yapd_buffer_upload_2d(
     int pixel_sz = bytes / (sz->w*sz->h);
     size_t origin[] = { 0, 0, 0 };
     size_t region[] = { sz->w*pixel_sz, sz->h, 1 };
+    if (buf->host) {
+        int y;
+        for (y = 0; y < sz->h; ++y) {
+            memcpy(
+                buf->host + y*region[0], data + y*stride, region[0]);
+        }
+        return;
+    }
     err = clEnqueueWriteBufferRect(
         buf->gpu->queue, buf->mem, CL_FALSE,
         origin, origin, region,
@@ -95,6 +188,10 @@ yapd_buffer_download_sync(
 {
     cl_int err;
     if (bytes == 0) return;
+    if (buf->host) {
+        memcpy(data, buf->host, bytes);
+        return;
+    }
     err = clEnqueueReadBuffer(
         buf->gpu->queue, buf->mem, CL_TRUE, 0, bytes, data, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
@@ -106,6 +203,10 @@ yapd_buffer_download(
 {
     cl_int err;
     if (bytes == 0) return;
+    if (buf->host) {
+        memcpy(data, buf->host, bytes);
+        return;
+    }
     err = clEnqueueReadBuffer(
         buf->gpu->queue, buf->mem, CL_FALSE, 0, bytes, data, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
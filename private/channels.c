@@ -10,7 +10,6 @@ release_buffers(
     yapd_channels_t* c)
 {
     yapd_buffer_release(&c->mag);
-    yapd_buffer_release(&c->angle);
     yapd_buffer_release(&c->hist);
     c->capacity.w = 0;
     c->capacity.h = 0;
@@ -38,8 +37,6 @@ reserve_buffers(
     c->capacity = c->crop_sz;
     c->mag = yapd_buffer_create(
         c->gpu, sizeof(float)*c->crop_sz.w*c->crop_sz.h);
-    c->angle = yapd_buffer_create(
-        c->gpu, sizeof(float)*c->crop_sz.w*c->crop_sz.h);
     c->hist = yapd_buffer_create(
         c->gpu, sizeof(cl_float8)*c->hist_sz.w*c->hist_sz.h);
 }
@@ -55,7 +52,8 @@ static const yapd_channels_opts_t default_opts = {
     },
     .grad_hist = {
         .bin_size = 0,
-        .num_orients = 6
+        .num_orients = 6,
+        .orient_lut = 0
     }
 };
 
@@ -83,7 +81,6 @@ yapd_channels_new(
     c.capacity.w = 0;
     c.capacity.h = 0;
     c.mag = yapd_buffer_create(gpu, 0);
-    c.angle = yapd_buffer_create(gpu, 0);
     c.hist = yapd_buffer_create(gpu, 0);
 
     assert(c.opts.grad_hist.num_orients <= 8);
@@ -104,6 +101,14 @@ yapd_channels_new(
     yapd_buffer_upload(
         &c.mag_norm_filter, (uint8_t*)c.mag_norm_filter_host, bytes);
 
+    c.acos_lut_host = NULL;
+    c.acos_lut = yapd_buffer_readonly(gpu, 0);
+    if (c.opts.grad_hist.orient_lut) {
+        yapd_acos_lut(a, aud, &c.acos_lut_host, &bytes);
+        c.acos_lut = yapd_buffer_readonly(gpu, bytes);
+        yapd_buffer_upload(&c.acos_lut, (uint8_t*)c.acos_lut_host, bytes);
+    }
+
     reserve_buffers(&c, cap_w, cap_h);
 
     return c;
@@ -122,6 +127,10 @@ yapd_channels_release(
     c->a.dealloc(c->aud, c->mag_norm_filter_host);
     c->mag_norm_filter_host = NULL;
     yapd_buffer_release(&c->mag_norm_filter);
+
+    if (c->acos_lut_host) c->a.dealloc(c->aud, c->acos_lut_host);
+    c->acos_lut_host = NULL;
+    yapd_buffer_release(&c->acos_lut);
 }
 
 void
@@ -131,43 +140,96 @@ yapd_channels_prepare(
 {
     assert(sz->w > 0 && sz->h > 0);
     reserve_buffers(c, sz->w, sz->h);
-    yapd_buffer_reserve(
+    // outputs are optional when computed into views
+    if (color) yapd_buffer_reserve(
         color, sizeof(cl_float4)*c->data_sz.w*c->data_sz.h);
-    yapd_buffer_reserve(
+    if (mag) yapd_buffer_reserve(
         mag, sizeof(float)*c->data_sz.w*c->data_sz.h);
-    yapd_buffer_reserve(
+    if (hist) yapd_buffer_reserve(
         hist, sizeof(cl_float8)*c->data_sz.w*c->data_sz.h);
 }
 
+static yapd_channels_out_t
+plain_out(
+    yapd_channels_t* c, yapd_buffer_t* color,
+    yapd_buffer_t* mag, yapd_buffer_t* hist)
+{
+    yapd_channels_out_t out;
+    out.color = yapd_buffer_view(color, c->data_sz.w, 4);
+    out.mag = yapd_buffer_view(mag, c->data_sz.w, 1);
+    out.hist = yapd_buffer_view(hist, c->data_sz.w, 8);
+    return out;
+}
+
+// channels of already smoothed `img`
+static void
+compute_smoothed(
+    yapd_channels_t* c, yapd_buffer_t* img,
+    yapd_buffer_t* tmp, const yapd_channels_out_t* out)
+{
+    const int direct = yapd_size_equals(&c->hist_sz, &c->data_sz);
+    const yapd_buffer_view_t ohist = direct ?
+        out->hist : yapd_buffer_view(&c->hist, c->hist_sz.w, 8);
+    yapd_buffer_resample32fc4_view(
+        &out->color, &c->data_sz, img, &c->crop_sz, 1.0f);
+    // gradient magnitude, angles are recomputed by histogram pass
+    yapd_gradient_mag32fc4(
+        img, &c->crop_sz, &c->mag, NULL);
+    // normalized magnitude and gradient histogram
+    yapd_gradient_norm_hist32fc4(
+        &ohist, img, &c->mag, &c->hist_sz, tmp, c->opts.grad_mag.norm_const,
+        c->opts.grad_mag.norm_radius, &c->mag_norm_filter,
+        c->opts.grad_hist.bin_size, c->opts.grad_hist.num_orients,
+        &c->acos_lut);
+    yapd_buffer_resample32f_view(
+        &out->mag, &c->data_sz, &c->mag, &c->crop_sz, 1.0f);
+    if (!direct) {
+        yapd_buffer_resample32fc8_view(
+            &out->hist, &c->data_sz, &c->hist, &c->hist_sz, 1.0f);
+    }
+}
+
 void
 yapd_channels_compute(
     yapd_channels_t* c, yapd_buffer_t* img,
     yapd_buffer_t* tmp, yapd_buffer_t* color,
     yapd_buffer_t* mag, yapd_buffer_t* hist)
 {
-    yapd_buffer_t* ohist =
-        yapd_size_equals(&c->hist_sz, &c->data_sz) ? hist : &c->hist;
+    const yapd_channels_out_t out = plain_out(c, color, mag, hist);
+    yapd_channels_compute_view(c, img, tmp, &out);
+}
+
+void
+yapd_channels_compute_view(
+    yapd_channels_t* c, yapd_buffer_t* img,
+    yapd_buffer_t* tmp, const yapd_channels_out_t* out)
+{
     // presmooth
     yapd_buffer_conv_tri32fc4(
         img, tmp, &c->crop_sz, c->opts.color.smooth, &c->smooth_filter);
-    yapd_buffer_resample32fc4(
-        color, &c->data_sz, img, &c->crop_sz, 1.0f);
-    // gradient magnitude
-    yapd_gradient_mag32fc4(
-        img, &c->crop_sz, &c->mag, &c->angle);
-    yapd_gradient_mag_norm(
-        &c->mag, &c->crop_sz, tmp, c->opts.grad_mag.norm_const,
-        c->opts.grad_mag.norm_radius, &c->mag_norm_filter);
-    yapd_buffer_resample32f(
-        mag, &c->data_sz, &c->mag, &c->crop_sz, 1.0f);
-    // gradient histogram
-    yapd_gradient_scale_angle(
-        &c->angle, &c->crop_sz, c->opts.grad_hist.num_orients / CL_M_PI_F);
-    yapd_gradient_hist(
-        ohist, &c->mag, &c->angle, &c->hist_sz,
-        c->opts.grad_hist.bin_size, c->opts.grad_hist.num_orients);
-    if (ohist != hist) {
-        yapd_buffer_resample32fc8(
-            hist, &c->data_sz, ohist, &c->hist_sz, 1.0f);
-    }
-}
\ No newline at end of file
+    compute_smoothed(c, img, tmp, out);
+}
+
+void
+yapd_channels_compute_rgb8uc4(
+    yapd_channels_t* c, yapd_buffer_t* rgb, const yapd_size_t* rgb_sz,
+    yapd_buffer_t* img, yapd_buffer_t* tmp, yapd_buffer_t* color,
+    yapd_buffer_t* mag, yapd_buffer_t* hist)
+{
+    const yapd_channels_out_t out = plain_out(c, color, mag, hist);
+    yapd_channels_compute_rgb8uc4_view(c, rgb, rgb_sz, img, tmp, &out);
+}
+
+void
+yapd_channels_compute_rgb8uc4_view(
+    yapd_channels_t* c, yapd_buffer_t* rgb, const yapd_size_t* rgb_sz,
+    yapd_buffer_t* img, yapd_buffer_t* tmp, const yapd_channels_out_t* out)
+{
+    yapd_buffer_reserve(img, sizeof(cl_float4)*c->crop_sz.w*c->crop_sz.h);
+    yapd_buffer_reserve(tmp, sizeof(cl_float4)*c->crop_sz.w*c->crop_sz.h);
+    // LUV, resample and presmooth from source pixels
+    yapd_buffer_luv_smooth_rgb8uc4(
+        img, tmp, &c->crop_sz, rgb, rgb_sz,
+        c->opts.color.smooth, &c->smooth_filter);
+    compute_smoothed(c, img, tmp, out);
+}
@@ -2,47 +2,58 @@
 #include <yapd/buffer.h>
 
 #include <yapd/gpu.h>
+#include <cpu/cpu.h>
 #include <color.cl.h>
 #include <color_consts.h>
 
+extern void
+yapd_gpu_conv_tri_rows32fc4(
+    yapd_buffer_t* dst, yapd_buffer_t* src,
+    const yapd_size_t* sz, int r, yapd_buffer_t* filter);
+
+// LUV constants are the first arguments of all color kernels.
+static void
+set_consts(
+    yapd_gpu_t* gpu, cl_kernel k)
+{
+    cl_int err;
+    err = clSetKernelArg(k, 0, sizeof(float), &color_consts.minu);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 1, sizeof(float), &color_consts.minv);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 2, sizeof(float), &color_consts.un);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 3, sizeof(float), &color_consts.vn);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 4, sizeof(cl_float4), &color_consts.mr);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 5, sizeof(cl_float4), &color_consts.mg);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 6, sizeof(cl_float4), &color_consts.mb);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 7, sizeof(cl_mem), &gpu->color.ltable.mem);
+    assert(err == CL_SUCCESS);
+}
+
 void
 yapd_gpu_setup_color(
     yapd_gpu_t* gpu)
 {
     cl_int err;
     yapd_gpu_color_ctx_t* c = &gpu->color;
-    c->program = yapd_gpu_load_program(gpu, color_cl);
+    c->program = yapd_gpu_load_program(gpu, color_cl, NULL);
     c->luv_from_rgb8uc4 = clCreateKernel(c->program, "luv_from_rgb8uc4", &err);
     assert(err == CL_SUCCESS);
+    c->luv_smooth_cols_rgb8uc4 = clCreateKernel(
+        c->program, "luv_smooth_cols_rgb8uc4", &err);
+    assert(err == CL_SUCCESS);
 
     gpu->color.ltable = yapd_buffer_readonly(gpu, sizeof(color_ltable));
     yapd_buffer_upload(
         &gpu->color.ltable, (uint8_t*)color_ltable, sizeof(color_ltable));
 
-    err = clSetKernelArg(
-        c->luv_from_rgb8uc4, 0, sizeof(float), &color_consts.minu);
-    assert(err == CL_SUCCESS);
-    err = clSetKernelArg(
-        c->luv_from_rgb8uc4, 1, sizeof(float), &color_consts.minv);
-    assert(err == CL_SUCCESS);
-    err = clSetKernelArg(
-        c->luv_from_rgb8uc4, 2, sizeof(float), &color_consts.un);
-    assert(err == CL_SUCCESS);
-    err = clSetKernelArg(
-        c->luv_from_rgb8uc4, 3, sizeof(float), &color_consts.vn);
-    assert(err == CL_SUCCESS);
-    err = clSetKernelArg(
-        c->luv_from_rgb8uc4, 4, sizeof(cl_float4), &color_consts.mr);
-    assert(err == CL_SUCCESS);
-    err = clSetKernelArg(
-        c->luv_from_rgb8uc4, 5, sizeof(cl_float4), &color_consts.mg);
-    assert(err == CL_SUCCESS);
-    err = clSetKernelArg(
-        c->luv_from_rgb8uc4, 6, sizeof(cl_float4), &color_consts.mb);
-    assert(err == CL_SUCCESS);
-    err = clSetKernelArg(
-        c->luv_from_rgb8uc4, 7, sizeof(cl_mem), &c->ltable.mem);
-    assert(err == CL_SUCCESS);
+    set_consts(gpu, c->luv_from_rgb8uc4);
+    set_consts(gpu, c->luv_smooth_cols_rgb8uc4);
 }
 
 void
@@ -52,6 +63,7 @@ yapd_gpu_release_color(
     yapd_gpu_color_ctx_t* c = &gpu->color;
     yapd_buffer_release(&c->ltable);
     clReleaseKernel(c->luv_from_rgb8uc4);
+    clReleaseKernel(c->luv_smooth_cols_rgb8uc4);
     clReleaseProgram(c->program);
 }
 
@@ -68,6 +80,12 @@ yapd_buffer_luv_from_rgb8uc4(
     assert(dst->bytes >= sizeof(cl_float4)*sz->w*sz->h);
     assert(src->bytes >= sizeof(cl_uchar4)*sz->w*sz->h);
 
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        yapd_cpu_luv_from_rgb8uc4(
+            gpu, (float*)dst->host, src->host, sz->w*sz->h);
+        return;
+    }
+
     err = clSetKernelArg(c->luv_from_rgb8uc4, 8, sizeof(cl_mem), &dst->mem);
     assert(err == CL_SUCCESS);
     err = clSetKernelArg(c->luv_from_rgb8uc4, 9, sizeof(cl_mem), &src->mem);
@@ -75,4 +93,57 @@ yapd_buffer_luv_from_rgb8uc4(
     err = clEnqueueNDRangeKernel(
         gpu->queue, c->luv_from_rgb8uc4, 1, NULL, size, NULL, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
-}
\ No newline at end of file
+}
+
+void
+yapd_buffer_luv_smooth_rgb8uc4(
+    yapd_buffer_t* dst, yapd_buffer_t* tmp, const yapd_size_t* dst_sz,
+    yapd_buffer_t* src, const yapd_size_t* src_sz,
+    int r, yapd_buffer_t* filter)
+{
+    cl_int err;
+    yapd_gpu_t* gpu = dst->gpu;
+    size_t offset[] = { 0, 0, 0 };
+    size_t size[] = { dst_sz->w, dst_sz->h, 1 };
+    yapd_gpu_color_ctx_t* c = &gpu->color;
+    // column pass goes straight to `dst` if there is no row pass
+    yapd_buffer_t* cols = r > 0 ? tmp : dst;
+
+    assert(gpu == tmp->gpu && gpu == src->gpu && gpu == filter->gpu);
+    assert(dst->bytes >= sizeof(cl_float4)*dst_sz->w*dst_sz->h);
+    assert(tmp->bytes >= sizeof(cl_float4)*dst_sz->w*dst_sz->h);
+    assert(src->bytes >= sizeof(cl_uchar4)*src_sz->w*src_sz->h);
+    assert(filter->bytes >= (2 * r + 1) * sizeof(float));
+
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        yapd_cpu_luv_resample_rgb8uc4(
+            gpu, (float*)dst->host, dst_sz, src->host, src_sz);
+        if (r > 0) yapd_buffer_conv_tri32fc4(dst, tmp, dst_sz, r, filter);
+        return;
+    }
+
+    err = clSetKernelArg(
+        c->luv_smooth_cols_rgb8uc4, 8, sizeof(int), &r);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(
+        c->luv_smooth_cols_rgb8uc4, 9, sizeof(cl_mem), &filter->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(
+        c->luv_smooth_cols_rgb8uc4, 10, sizeof(cl_mem), &cols->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(
+        c->luv_smooth_cols_rgb8uc4, 11, sizeof(cl_int2), dst_sz);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(
+        c->luv_smooth_cols_rgb8uc4, 12, sizeof(cl_mem), &src->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(
+        c->luv_smooth_cols_rgb8uc4, 13, sizeof(cl_int2), src_sz);
+    assert(err == CL_SUCCESS);
+    err = clEnqueueNDRangeKernel(
+        gpu->queue, c->luv_smooth_cols_rgb8uc4,
+        2, offset, size, NULL, 0, NULL, NULL);
+    assert(err == CL_SUCCESS);
+
+    if (r > 0) yapd_gpu_conv_tri_rows32fc4(dst, tmp, dst_sz, r, filter);
+}
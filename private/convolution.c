@@ -2,64 +2,185 @@
 #include <yapd/buffer.h>
 
 #include <yapd/gpu.h>
+#include <cpu/cpu.h>
 #include <convolution.cl.h>
 
+enum { TILE_W = 16, TILE_H = 8 };
+
+// picks the tiled kernel if its tile fits in local memory, then sets its
+// local argument and rounds global size up to the work-group size.
+static cl_kernel
+pick(
+    yapd_gpu_t* gpu, cl_kernel kernel, cl_kernel tiled, int tile_arg,
+    int pixel_sz, int r, int dir_x, const yapd_size_t* sz,
+    size_t* size, const size_t** local)
+{
+    cl_int err;
+    static const size_t tile[] = { TILE_W, TILE_H, 1 };
+    const size_t bytes = (size_t)pixel_sz*
+        (TILE_W + (dir_x ? 2*r : 0))*(TILE_H + (dir_x ? 0 : 2*r));
+    yapd_gpu_convolution_ctx_t* c = &gpu->convolution;
+    size[0] = sz->w;
+    size[1] = sz->h;
+    size[2] = 1;
+    *local = NULL;
+    if (!tiled || !c->tiled || bytes > c->local_mem) return kernel;
+    size[0] = (sz->w + TILE_W - 1) / TILE_W * TILE_W;
+    size[1] = (sz->h + TILE_H - 1) / TILE_H * TILE_H;
+    *local = tile;
+    err = clSetKernelArg(tiled, tile_arg, bytes, NULL);
+    assert(err == CL_SUCCESS);
+    return tiled;
+}
+
+static int
+use_sum(
+    yapd_gpu_t* gpu, int r)
+{
+    const int sum_radius = gpu->convolution.sum_radius;
+    return sum_radius > 0 && r >= sum_radius;
+}
+
+// running sum triangle filter along columns or rows, offsets are in floats.
 static void
-conv_tri32f(
-    int pixel_sz, cl_kernel kernel,
-    yapd_buffer_t* img, yapd_buffer_t* tmp,
-    const yapd_size_t* sz, int r, yapd_buffer_t* filter)
+conv_tri_sum(
+    yapd_gpu_t* gpu, int channels, int r, const yapd_size_t* sz, int rows,
+    yapd_buffer_t* dst, int dst_off, yapd_buffer_t* src, int src_off)
 {
     cl_int err;
-    yapd_gpu_t* gpu = img->gpu;
+    cl_int2 line_step;
+    int n, step;
     size_t offset[] = { 0, 0, 0 };
-    size_t size[] = { sz->w, sz->h, 1 };
-    cl_int2 dir;
+    size_t size[] = { 0, 0, 1 };
+    yapd_gpu_convolution_ctx_t* c = &gpu->convolution;
 
-    assert(gpu == tmp->gpu && gpu == filter->gpu);
-    assert(img->bytes >= pixel_sz * sz->w*sz->h);
-    assert(tmp->bytes >= pixel_sz * sz->w*sz->h);
-    assert(filter->bytes >= (2 * r + 1) * sizeof(float));
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        float* const d = (float*)dst->host + dst_off;
+        const float* const s = (float*)src->host + src_off;
+        if (rows) {
+            yapd_cpu_conv_tri_sum_rows(gpu, channels, r, sz, d, s);
+        } else {
+            yapd_cpu_conv_tri_sum_cols(gpu, channels, r, sz, d, s);
+        }
+        return;
+    }
+
+    if (rows) { // a line per channel of each row
+        n = sz->w;
+        step = channels;
+        size[0] = channels;
+        size[1] = sz->h;
+        line_step.s0 = 1;
+        line_step.s1 = sz->w*channels;
+    } else { // a line per float of first row
+        n = sz->h;
+        step = sz->w*channels;
+        size[0] = sz->w*channels;
+        size[1] = 1;
+        line_step.s0 = 1;
+        line_step.s1 = 0;
+    }
 
-    err = clSetKernelArg(kernel, 0, sizeof(int), &r);
+    err = clSetKernelArg(c->conv_tri_sum32f, 0, sizeof(int), &r);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(kernel, 2, sizeof(cl_mem), &filter->mem);
+    err = clSetKernelArg(c->conv_tri_sum32f, 1, sizeof(int), &n);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(kernel, 3, sizeof(cl_int2), sz);
+    err = clSetKernelArg(c->conv_tri_sum32f, 2, sizeof(int), &step);
     assert(err == CL_SUCCESS);
-
-    // convolution each columns
-    dir.s0 = 0; dir.s1 = 1;
-    err = clSetKernelArg(kernel, 1, sizeof(cl_int2), &dir);
+    err = clSetKernelArg(c->conv_tri_sum32f, 3, sizeof(cl_int2), &line_step);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(c->conv_tri_sum32f, 4, sizeof(cl_mem), &dst->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(kernel, 4, sizeof(cl_mem), &tmp->mem);
+    err = clSetKernelArg(c->conv_tri_sum32f, 5, sizeof(int), &dst_off);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(kernel, 5, sizeof(cl_mem), &img->mem);
+    err = clSetKernelArg(c->conv_tri_sum32f, 6, sizeof(cl_mem), &src->mem);
     assert(err == CL_SUCCESS);
+    err = clSetKernelArg(c->conv_tri_sum32f, 7, sizeof(int), &src_off);
+    assert(err == CL_SUCCESS);
+
     err = clEnqueueNDRangeKernel(
-        gpu->queue, kernel, 2, offset, size, NULL, 0, NULL, NULL);
+        gpu->queue, c->conv_tri_sum32f, 2, offset, size, NULL, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
+}
+
+// single pass of triangle filter along columns or rows.
+static void
+conv_tri_pass(
+    int pixel_sz, cl_kernel kernel, cl_kernel tiled, int rows,
+    yapd_buffer_t* dst, yapd_buffer_t* src,
+    const yapd_size_t* sz, int r, yapd_buffer_t* filter)
+{
+    cl_int err;
+    cl_kernel k;
+    yapd_gpu_t* gpu = dst->gpu;
+    const int channels = pixel_sz / sizeof(float);
+    size_t offset[] = { 0, 0, 0 };
+    size_t size[3];
+    const size_t* local;
+    cl_int2 dir;
+
+    assert(gpu == src->gpu && gpu == filter->gpu);
+    assert(dst->bytes >= pixel_sz * sz->w*sz->h);
+    assert(src->bytes >= pixel_sz * sz->w*sz->h);
+    assert(filter->bytes >= (2 * r + 1) * sizeof(float));
+
+    if (use_sum(gpu, r)) {
+        conv_tri_sum(gpu, channels, r, sz, rows, dst, 0, src, 0);
+        return;
+    }
+
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        if (rows) {
+            yapd_cpu_conv_tri_rows(
+                gpu, channels, r, (float*)filter->host, sz,
+                (float*)dst->host, (float*)src->host);
+        } else {
+            yapd_cpu_conv_tri_cols(
+                gpu, channels, r, (float*)filter->host, sz,
+                (float*)dst->host, (float*)src->host);
+        }
+        return;
+    }
 
-    // convolution each rows
-    dir.s0 = 1; dir.s1 = 0;
-    err = clSetKernelArg(kernel, 1, sizeof(cl_int2), &dir);
+    dir.s0 = rows ? 1 : 0;
+    dir.s1 = rows ? 0 : 1;
+    k = pick(gpu, kernel, tiled, 6, pixel_sz, r, rows, sz, size, &local);
+    err = clSetKernelArg(k, 0, sizeof(int), &r);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 1, sizeof(cl_int2), &dir);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 2, sizeof(cl_mem), &filter->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(kernel, 4, sizeof(cl_mem), &img->mem);
+    err = clSetKernelArg(k, 3, sizeof(cl_int2), sz);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(kernel, 5, sizeof(cl_mem), &tmp->mem);
+    err = clSetKernelArg(k, 4, sizeof(cl_mem), &dst->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 5, sizeof(cl_mem), &src->mem);
     assert(err == CL_SUCCESS);
     err = clEnqueueNDRangeKernel(
-        gpu->queue, kernel, 2, offset, size, NULL, 0, NULL, NULL);
+        gpu->queue, k, 2, offset, size, local, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
 }
 
+static void
+conv_tri32f(
+    int pixel_sz, cl_kernel kernel, cl_kernel tiled,
+    yapd_buffer_t* img, yapd_buffer_t* tmp,
+    const yapd_size_t* sz, int r, yapd_buffer_t* filter)
+{
+    // convolution each columns, then each rows
+    conv_tri_pass(pixel_sz, kernel, tiled, FALSE, tmp, img, sz, r, filter);
+    conv_tri_pass(pixel_sz, kernel, tiled, TRUE, img, tmp, sz, r, filter);
+}
+
 void
 yapd_gpu_setup_convolution(
     yapd_gpu_t* gpu)
 {
     cl_int err;
+    size_t wg_sz;
     yapd_gpu_convolution_ctx_t* c = &gpu->convolution;
-    c->program = yapd_gpu_load_program(gpu, convolution_cl);
+    c->program = yapd_gpu_load_program(gpu, convolution_cl, NULL);
     c->conv_tri_cols32f = clCreateKernel(c->program, "conv_tri_cols32f", &err);
     assert(err == CL_SUCCESS);
     c->conv_tri_rows32f = clCreateKernel(c->program, "conv_tri_rows32f", &err);
@@ -72,6 +193,38 @@ yapd_gpu_setup_convolution(
     assert(err == CL_SUCCESS);
     c->conv_tri32fc16 = clCreateKernel(c->program, "conv_tri32fc16", &err);
     assert(err == CL_SUCCESS);
+    c->conv_tri32fc10 = clCreateKernel(c->program, "conv_tri32fc10", &err);
+    assert(err == CL_SUCCESS);
+    c->conv_tri_sum32f = clCreateKernel(c->program, "conv_tri_sum32f", &err);
+    assert(err == CL_SUCCESS);
+    c->conv_tri_cols32f_tiled = clCreateKernel(
+        c->program, "conv_tri_cols32f_tiled", &err);
+    assert(err == CL_SUCCESS);
+    c->conv_tri_rows32f_tiled = clCreateKernel(
+        c->program, "conv_tri_rows32f_tiled", &err);
+    assert(err == CL_SUCCESS);
+    c->conv_tri32f_tiled = clCreateKernel(
+        c->program, "conv_tri32f_tiled", &err);
+    assert(err == CL_SUCCESS);
+    c->conv_tri32fc4_tiled = clCreateKernel(
+        c->program, "conv_tri32fc4_tiled", &err);
+    assert(err == CL_SUCCESS);
+    c->conv_tri32fc8_tiled = clCreateKernel(
+        c->program, "conv_tri32fc8_tiled", &err);
+    assert(err == CL_SUCCESS);
+    c->conv_tri32fc16_tiled = clCreateKernel(
+        c->program, "conv_tri32fc16_tiled", &err);
+    assert(err == CL_SUCCESS);
+    err = clGetDeviceInfo(
+        gpu->dev_ids[0], CL_DEVICE_LOCAL_MEM_SIZE,
+        sizeof(cl_ulong), &c->local_mem, NULL);
+    assert(err == CL_SUCCESS);
+    // float16 variant is the heaviest one
+    err = clGetKernelWorkGroupInfo(
+        c->conv_tri32fc16_tiled, gpu->dev_ids[0], CL_KERNEL_WORK_GROUP_SIZE,
+        sizeof(size_t), &wg_sz, NULL);
+    assert(err == CL_SUCCESS);
+    c->tiled = wg_sz >= TILE_W*TILE_H;
 }
 
 void
@@ -85,6 +238,14 @@ yapd_gpu_release_convolution(
     clReleaseKernel(c->conv_tri32fc4);
     clReleaseKernel(c->conv_tri32fc8);
     clReleaseKernel(c->conv_tri32fc16);
+    clReleaseKernel(c->conv_tri32fc10);
+    clReleaseKernel(c->conv_tri_sum32f);
+    clReleaseKernel(c->conv_tri_cols32f_tiled);
+    clReleaseKernel(c->conv_tri_rows32f_tiled);
+    clReleaseKernel(c->conv_tri32f_tiled);
+    clReleaseKernel(c->conv_tri32fc4_tiled);
+    clReleaseKernel(c->conv_tri32fc8_tiled);
+    clReleaseKernel(c->conv_tri32fc16_tiled);
     clReleaseProgram(c->program);
 }
 
@@ -116,9 +277,11 @@ yapd_buffer_conv_tri_cols32f(
     const yapd_size_t* sz, int r, yapd_buffer_t* filter)
 {
     cl_int err;
+    cl_kernel k;
     yapd_gpu_t* gpu = dst->gpu;
     size_t offset[] = { 0, 0, 0 };
-    size_t size[] = { sz->w, sz->h, 1 };
+    size_t size[3];
+    const size_t* local;
     yapd_gpu_convolution_ctx_t* c = &gpu->convolution;
 
     assert(gpu == src->gpu && gpu == filter->gpu);
@@ -126,21 +289,36 @@ yapd_buffer_conv_tri_cols32f(
     assert(src->bytes >= sizeof(float)*sz->w*sz->h);
     assert(filter->bytes >= (2 * r + 1) * sizeof(float));
 
-    err = clSetKernelArg(c->conv_tri_cols32f, 0, sizeof(int), &r);
+    if (use_sum(gpu, r)) {
+        conv_tri_sum(gpu, 1, r, sz, FALSE, dst, dst_off, src, 0);
+        return;
+    }
+
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        yapd_cpu_conv_tri_cols(
+            gpu, 1, r, (float*)filter->host, sz,
+            (float*)dst->host + dst_off, (float*)src->host);
+        return;
+    }
+
+    k = pick(
+        gpu, c->conv_tri_cols32f, c->conv_tri_cols32f_tiled, 6,
+        sizeof(float), r, FALSE, sz, size, &local);
+    err = clSetKernelArg(k, 0, sizeof(int), &r);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->conv_tri_cols32f, 1, sizeof(cl_mem), &filter->mem);
+    err = clSetKernelArg(k, 1, sizeof(cl_mem), &filter->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->conv_tri_cols32f, 2, sizeof(cl_int2), sz);
+    err = clSetKernelArg(k, 2, sizeof(cl_int2), sz);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->conv_tri_cols32f, 3, sizeof(cl_mem), &dst->mem);
+    err = clSetKernelArg(k, 3, sizeof(cl_mem), &dst->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->conv_tri_cols32f, 4, sizeof(int), &dst_off);
+    err = clSetKernelArg(k, 4, sizeof(int), &dst_off);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->conv_tri_cols32f, 5, sizeof(cl_mem), &src->mem);
+    err = clSetKernelArg(k, 5, sizeof(cl_mem), &src->mem);
     assert(err == CL_SUCCESS);
 
     err = clEnqueueNDRangeKernel(
-        gpu->queue, c->conv_tri_cols32f, 2, offset, size, NULL, 0, NULL, NULL);
+        gpu->queue, k, 2, offset, size, local, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
 }
 
@@ -150,9 +328,11 @@ yapd_buffer_conv_tri_rows32f(
     const yapd_size_t* sz, int r, yapd_buffer_t* filter)
 {
     cl_int err;
+    cl_kernel k;
     yapd_gpu_t* gpu = buf->gpu;
     size_t offset[] = { 0, 0, 0 };
-    size_t size[] = { sz->w, sz->h, 1 };
+    size_t size[3];
+    const size_t* local;
     int hi_off = dst_off > src_off ? dst_off : src_off;
     int lo_off = dst_off < src_off ? dst_off : src_off;
     yapd_gpu_convolution_ctx_t* c = &gpu->convolution;
@@ -162,21 +342,36 @@ yapd_buffer_conv_tri_rows32f(
     assert(lo_off + sz->w*sz->h <= hi_off);
     assert(filter->bytes >= (2 * r + 1) * sizeof(float));
 
-    err = clSetKernelArg(c->conv_tri_rows32f, 0, sizeof(int), &r);
+    if (use_sum(gpu, r)) {
+        conv_tri_sum(gpu, 1, r, sz, TRUE, buf, dst_off, buf, src_off);
+        return;
+    }
+
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        yapd_cpu_conv_tri_rows(
+            gpu, 1, r, (float*)filter->host, sz,
+            (float*)buf->host + dst_off, (float*)buf->host + src_off);
+        return;
+    }
+
+    k = pick(
+        gpu, c->conv_tri_rows32f, c->conv_tri_rows32f_tiled, 6,
+        sizeof(float), r, TRUE, sz, size, &local);
+    err = clSetKernelArg(k, 0, sizeof(int), &r);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->conv_tri_rows32f, 1, sizeof(cl_mem), &filter->mem);
+    err = clSetKernelArg(k, 1, sizeof(cl_mem), &filter->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->conv_tri_rows32f, 2, sizeof(cl_int2), sz);
+    err = clSetKernelArg(k, 2, sizeof(cl_int2), sz);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->conv_tri_rows32f, 3, sizeof(cl_mem), &buf->mem);
+    err = clSetKernelArg(k, 3, sizeof(cl_mem), &buf->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->conv_tri_rows32f, 4, sizeof(int), &dst_off);
+    err = clSetKernelArg(k, 4, sizeof(int), &dst_off);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->conv_tri_rows32f, 5, sizeof(int), &src_off);
+    err = clSetKernelArg(k, 5, sizeof(int), &src_off);
     assert(err == CL_SUCCESS);
 
     err = clEnqueueNDRangeKernel(
-        gpu->queue, c->conv_tri_rows32f, 2, offset, size, NULL, 0, NULL, NULL);
+        gpu->queue, k, 2, offset, size, local, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
 }
 
@@ -187,6 +382,7 @@ yapd_buffer_conv_tri32f(
 {
     conv_tri32f(
         sizeof(float), img->gpu->convolution.conv_tri32f,
+        img->gpu->convolution.conv_tri32f_tiled,
         img, tmp, sz, r, filter);
 }
 
@@ -197,6 +393,7 @@ yapd_buffer_conv_tri32fc4(
 {
     conv_tri32f(
         sizeof(cl_float4), img->gpu->convolution.conv_tri32fc4,
+        img->gpu->convolution.conv_tri32fc4_tiled,
         img, tmp, sz, r, filter);
 }
 
@@ -207,6 +404,7 @@ yapd_buffer_conv_tri32fc8(
 {
     conv_tri32f(
         sizeof(cl_float8), img->gpu->convolution.conv_tri32fc8,
+        img->gpu->convolution.conv_tri32fc8_tiled,
         img, tmp, sz, r, filter);
 }
 
@@ -217,5 +415,29 @@ yapd_buffer_conv_tri32fc16(
 {
     conv_tri32f(
         sizeof(cl_float16), img->gpu->convolution.conv_tri32fc16,
+        img->gpu->convolution.conv_tri32fc16_tiled,
+        img, tmp, sz, r, filter);
+}
+
+void
+yapd_buffer_conv_tri32fc10(
+    yapd_buffer_t* img, yapd_buffer_t* tmp,
+    const yapd_size_t* sz, int r, yapd_buffer_t* filter)
+{
+    // no tiled variant, 10 floats don't make a vector type
+    conv_tri32f(
+        sizeof(float)*10, img->gpu->convolution.conv_tri32fc10, NULL,
         img, tmp, sz, r, filter);
-}
\ No newline at end of file
+}
+
+// rows pass only, used by the fused color stage.
+void
+yapd_gpu_conv_tri_rows32fc4(
+    yapd_buffer_t* dst, yapd_buffer_t* src,
+    const yapd_size_t* sz, int r, yapd_buffer_t* filter)
+{
+    conv_tri_pass(
+        sizeof(cl_float4), dst->gpu->convolution.conv_tri32fc4,
+        dst->gpu->convolution.conv_tri32fc4_tiled, TRUE,
+        dst, src, sz, r, filter);
+}
@@ -0,0 +1,133 @@
+/* Copyright (c) 2018 Giang "Yakiro" Nguyen. All rights reserved. */
+#include <cpu/cpu.h>
+
+#include <color_consts.h>
+
+static YAPD_INLINE void
+luv(
+    float* dst, const uint8_t* src)
+{
+    const float r = src[0];
+    const float g = src[1];
+    const float b = src[2];
+    const color_consts_t* c = &color_consts;
+    float x = c->mr.s[0]*r + c->mg.s[0]*g + c->mb.s[0]*b;
+    float y = c->mr.s[1]*r + c->mg.s[1]*g + c->mb.s[1]*b;
+    float z = c->mr.s[2]*r + c->mg.s[2]*g + c->mb.s[2]*b;
+    const float l = color_ltable[(int)(y*1024)];
+    z = 1.0f / (x + 15.0f*y + 3.0f*z + 1e-35f);
+    dst[0] = l;
+    dst[1] = l*(13.0f*4.0f*x*z - 13.0f*c->un) - c->minu;
+    dst[2] = l*(13.0f*9.0f*y*z - 13.0f*c->vn) - c->minv;
+    dst[3] = 0.0f;
+}
+
+#if defined(YAPD_CPU_AVX2) || defined(YAPD_CPU_SSE2)
+// 4 pixels at once, the table lookup stays scalar.
+static YAPD_INLINE void
+luv4(
+    float* dst, const uint8_t* src)
+{
+    const color_consts_t* c = &color_consts;
+    const __m128i px = _mm_loadu_si128((const __m128i*)src);
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128 r = _mm_cvtepi32_ps(_mm_and_si128(px, mask));
+    const __m128 g = _mm_cvtepi32_ps(
+        _mm_and_si128(_mm_srli_epi32(px, 8), mask));
+    const __m128 b = _mm_cvtepi32_ps(
+        _mm_and_si128(_mm_srli_epi32(px, 16), mask));
+    const __m128 x = _mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(_mm_set1_ps(c->mr.s[0]), r),
+        _mm_mul_ps(_mm_set1_ps(c->mg.s[0]), g)),
+        _mm_mul_ps(_mm_set1_ps(c->mb.s[0]), b));
+    const __m128 y = _mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(_mm_set1_ps(c->mr.s[1]), r),
+        _mm_mul_ps(_mm_set1_ps(c->mg.s[1]), g)),
+        _mm_mul_ps(_mm_set1_ps(c->mb.s[1]), b));
+    __m128 z = _mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(_mm_set1_ps(c->mr.s[2]), r),
+        _mm_mul_ps(_mm_set1_ps(c->mg.s[2]), g)),
+        _mm_mul_ps(_mm_set1_ps(c->mb.s[2]), b));
+    int li[4];
+    __m128 l, u, v, w = _mm_setzero_ps();
+    _mm_storeu_si128(
+        (__m128i*)li, _mm_cvttps_epi32(_mm_mul_ps(y, _mm_set1_ps(1024))));
+    l = _mm_setr_ps(
+        color_ltable[li[0]], color_ltable[li[1]],
+        color_ltable[li[2]], color_ltable[li[3]]);
+    z = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_add_ps(_mm_add_ps(
+        x, _mm_mul_ps(_mm_set1_ps(15.0f), y)),
+        _mm_mul_ps(_mm_set1_ps(3.0f), z)), _mm_set1_ps(1e-35f)));
+    u = _mm_sub_ps(_mm_mul_ps(l, _mm_sub_ps(
+        _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(13.0f*4.0f), x), z),
+        _mm_set1_ps(13.0f*c->un))), _mm_set1_ps(c->minu));
+    v = _mm_sub_ps(_mm_mul_ps(l, _mm_sub_ps(
+        _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(13.0f*9.0f), y), z),
+        _mm_set1_ps(13.0f*c->vn))), _mm_set1_ps(c->minv));
+    _MM_TRANSPOSE4_PS(l, u, v, w);
+    _mm_storeu_ps(dst + 0, l);
+    _mm_storeu_ps(dst + 4, u);
+    _mm_storeu_ps(dst + 8, v);
+    _mm_storeu_ps(dst + 12, w);
+}
+#endif
+
+void
+yapd_cpu_luv_from_rgb8uc4(
+    yapd_gpu_t* gpu, float* dst, const uint8_t* src, int n)
+{
+    int i;
+    const int n4 = n / 4;
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (i = 0; i < n4; ++i) {
+#if defined(YAPD_CPU_AVX2) || defined(YAPD_CPU_SSE2)
+        luv4(dst + i*16, src + i*16);
+#else
+        luv(dst + i*16 + 0, src + i*16 + 0);
+        luv(dst + i*16 + 4, src + i*16 + 4);
+        luv(dst + i*16 + 8, src + i*16 + 8);
+        luv(dst + i*16 + 12, src + i*16 + 12);
+#endif
+    }
+    for (i = n4*4; i < n; ++i) {
+        luv(dst + i*4, src + i*4);
+    }
+}
+
+void
+yapd_cpu_luv_resample_rgb8uc4(
+    yapd_gpu_t* gpu, float* dst, const yapd_size_t* dst_sz,
+    const uint8_t* src, const yapd_size_t* src_sz)
+{
+    int y;
+    const int src_row = src_sz->w*4;
+    if (yapd_size_equals(dst_sz, src_sz)) {
+        yapd_cpu_luv_from_rgb8uc4(gpu, dst, src, src_sz->w*src_sz->h);
+        return;
+    }
+    // converts 4 neighbors then mix, same order as resample of LUV image
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (y = 0; y < dst_sz->h; ++y) {
+        int x;
+        float c[4][4], c0[4], c1[4];
+        const float gy = y / (float)dst_sz->h * (src_sz->h - 1);
+        const int gyi = (int)gy;
+        const float ty = gy - gyi;
+        const uint8_t* const s0 = src + gyi*src_row;
+        const uint8_t* const s1 = s0 + src_row;
+        float* o = dst + y*dst_sz->w*4;
+        for (x = 0; x < dst_sz->w; ++x, o += 4) {
+            const float gx = x / (float)dst_sz->w * (src_sz->w - 1);
+            const int gxi = (int)gx;
+            const float tx = gx - gxi;
+            const int i = gxi*4;
+            luv(c[0], s0 + i);
+            luv(c[1], s0 + i + 4);
+            luv(c[2], s1 + i);
+            luv(c[3], s1 + i + 4);
+            yapd_cpu_mix(c0, c[0], c[1], tx, 4);
+            yapd_cpu_mix(c1, c[2], c[3], tx, 4);
+            yapd_cpu_mix(o, c0, c1, ty, 4);
+        }
+    }
+}
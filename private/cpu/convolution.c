@@ -0,0 +1,136 @@
+/* Copyright (c) 2018 Giang "Yakiro" Nguyen. All rights reserved. */
+#include <cpu/cpu.h>
+
+void
+yapd_cpu_conv_tri_cols(
+    yapd_gpu_t* gpu, int channels, int r, const float* filter,
+    const yapd_size_t* sz, float* dst, const float* src)
+{
+    int y;
+    const int row = sz->w*channels;
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (y = 0; y < sz->h; ++y) {
+        int i;
+        float* const o = dst + y*row;
+        yapd_cpu_mul(o, src + yapd_cpu_border(y - r, sz->h)*row, filter[0], row);
+        for (i = -r + 1; i <= r; ++i) {
+            const int p = yapd_cpu_border(y + i, sz->h);
+            yapd_cpu_madd(o, src + p*row, filter[i + r], row);
+        }
+    }
+}
+
+static YAPD_INLINE void
+border_pixel(
+    float* o, const float* s, int x,
+    int channels, int r, const float* filter, int w)
+{
+    int i, c;
+    for (c = 0; c < channels; ++c) {
+        float sum = 0.0f;
+        for (i = -r; i <= r; ++i) {
+            const int p = yapd_cpu_border(x + i, w);
+            sum += s[p*channels + c]*filter[i + r];
+        }
+        o[x*channels + c] = sum;
+    }
+}
+
+void
+yapd_cpu_conv_tri_rows(
+    yapd_gpu_t* gpu, int channels, int r, const float* filter,
+    const yapd_size_t* sz, float* dst, const float* src)
+{
+    int y;
+    const int row = sz->w*channels;
+    // pixels in [r, w - r) never touch the border
+    const int inner = sz->w - 2*r;
+    const int lo = inner > 0 ? r : sz->w;
+    const int hi = inner > 0 ? sz->w - r : sz->w;
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (y = 0; y < sz->h; ++y) {
+        int i, x;
+        float* const o = dst + y*row;
+        const float* const s = src + y*row;
+        if (inner > 0) {
+            yapd_cpu_mul(o + r*channels, s, filter[0], inner*channels);
+            for (i = -r + 1; i <= r; ++i) {
+                yapd_cpu_madd(
+                    o + r*channels, s + (r + i)*channels,
+                    filter[i + r], inner*channels);
+            }
+        }
+        for (x = 0; x < lo; ++x) {
+            border_pixel(o, s, x, channels, r, filter, sz->w);
+        }
+        for (x = hi; x < sz->w; ++x) {
+            border_pixel(o, s, x, channels, r, filter, sz->w);
+        }
+    }
+}
+
+enum { SUM_BLOCK = 256 };
+
+// running sums of n lanes, see conv_tri_sum32f kernel, i-th element
+// of lanes starts at src + i*stride.
+static void
+tri_sum(
+    int n, int r, int len, int stride, float* dst, const float* src)
+{
+    int i;
+    float lag[SUM_BLOCK], lead[SUM_BLOCK], sum[SUM_BLOCK];
+    const float nrm = 1.0f / ((r + 1)*(r + 1));
+#define E(i) (src + yapd_cpu_border(i, len)*stride)
+    memset(lag, 0, sizeof(float)*n);
+    for (i = -r; i <= 0; ++i) {
+        yapd_cpu_madd(lag, E(i), 1.0f, n);
+    }
+    memcpy(lead, lag, sizeof(float)*n);
+    memcpy(sum, lag, sizeof(float)*n);
+    for (i = 1; i <= r; ++i) {
+        yapd_cpu_madd(lead, E(i), 1.0f, n);
+        yapd_cpu_madd(lead, E(i - r - 1), -1.0f, n);
+        yapd_cpu_madd(sum, lead, 1.0f, n);
+    }
+    for (i = 0; i < len; ++i) {
+        yapd_cpu_mul(dst + i*stride, sum, nrm, n);
+        if (i + 1 == len) break;
+        yapd_cpu_madd(lead, E(i + r + 1), 1.0f, n);
+        yapd_cpu_madd(lead, E(i), -1.0f, n);
+        yapd_cpu_madd(sum, lead, 1.0f, n);
+        yapd_cpu_madd(sum, lag, -1.0f, n);
+        yapd_cpu_madd(lag, E(i + 1), 1.0f, n);
+        yapd_cpu_madd(lag, E(i - r), -1.0f, n);
+    }
+#undef E
+}
+
+void
+yapd_cpu_conv_tri_sum_cols(
+    yapd_gpu_t* gpu, int channels, int r,
+    const yapd_size_t* sz, float* dst, const float* src)
+{
+    int b;
+    const int row = sz->w*channels;
+    // lanes are blocks of columns
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (b = 0; b < row; b += SUM_BLOCK) {
+        const int n = YAPD_MIN(SUM_BLOCK, row - b);
+        tri_sum(n, r, sz->h, row, dst + b, src + b);
+    }
+}
+
+void
+yapd_cpu_conv_tri_sum_rows(
+    yapd_gpu_t* gpu, int channels, int r,
+    const yapd_size_t* sz, float* dst, const float* src)
+{
+    int y;
+    const int row = sz->w*channels;
+    assert(channels <= SUM_BLOCK);
+    // lanes are channels of each row
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (y = 0; y < sz->h; ++y) {
+        tri_sum(channels, r, sz->w, channels, dst + y*row, src + y*row);
+    }
+}
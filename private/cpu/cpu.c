@@ -0,0 +1,15 @@
+/* Copyright (c) 2018 Giang "Yakiro" Nguyen. All rights reserved. */
+#include <cpu/cpu.h>
+
+void
+yapd_cpu_setup(
+    yapd_gpu_t* gpu, int num_threads)
+{
+    assert(num_threads >= 0);
+#ifdef _OPENMP
+    if (num_threads == 0) num_threads = omp_get_max_threads();
+#else
+    num_threads = 1;
+#endif
+    gpu->cpu.num_threads = num_threads;
+}
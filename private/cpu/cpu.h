@@ -0,0 +1,259 @@
+/* Copyright (c) 2018 Giang "Yakiro" Nguyen. All rights reserved. */
+#pragma once
+
+#include <yapd/platform.h>
+#include <yapd/types.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__AVX2__)
+#define YAPD_CPU_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define YAPD_CPU_SSE2
+#include <emmintrin.h>
+#endif
+
+// native implementation of the OpenCL kernels, operates on host memory of
+// buffers created by a CPU backend, each function mirrors a kernel.
+
+static YAPD_INLINE int
+yapd_cpu_border(
+    int x, int n)
+{
+    // symmetric padding
+    return x < 0 ? -x : (x < n ? x : (2*n - x - 2));
+}
+
+// dst = src*f
+static YAPD_INLINE void
+yapd_cpu_mul(
+    float* dst, const float* src, float f, int n)
+{
+    int i = 0;
+#if defined(YAPD_CPU_AVX2)
+    const __m256 f8 = _mm256_set1_ps(f);
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_loadu_ps(src + i), f8));
+    }
+#endif
+#if defined(YAPD_CPU_AVX2) || defined(YAPD_CPU_SSE2)
+    const __m128 f4 = _mm_set1_ps(f);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), f4));
+    }
+#endif
+    for (; i < n; ++i) dst[i] = src[i]*f;
+}
+
+// dst += src*f
+static YAPD_INLINE void
+yapd_cpu_madd(
+    float* dst, const float* src, float f, int n)
+{
+    int i = 0;
+#if defined(YAPD_CPU_AVX2)
+    const __m256 f8 = _mm256_set1_ps(f);
+    for (; i + 8 <= n; i += 8) {
+        const __m256 s = _mm256_mul_ps(_mm256_loadu_ps(src + i), f8);
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), s));
+    }
+#endif
+#if defined(YAPD_CPU_AVX2) || defined(YAPD_CPU_SSE2)
+    const __m128 f4 = _mm_set1_ps(f);
+    for (; i + 4 <= n; i += 4) {
+        const __m128 s = _mm_mul_ps(_mm_loadu_ps(src + i), f4);
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), s));
+    }
+#endif
+    for (; i < n; ++i) dst[i] += src[i]*f;
+}
+
+// dst = a + (b - a)*t, same as OpenCL mix()
+static YAPD_INLINE void
+yapd_cpu_mix(
+    float* dst, const float* a, const float* b, float t, int n)
+{
+    int i = 0;
+#if defined(YAPD_CPU_AVX2)
+    const __m256 t8 = _mm256_set1_ps(t);
+    for (; i + 8 <= n; i += 8) {
+        const __m256 a8 = _mm256_loadu_ps(a + i);
+        const __m256 d8 = _mm256_sub_ps(_mm256_loadu_ps(b + i), a8);
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(a8, _mm256_mul_ps(d8, t8)));
+    }
+#endif
+#if defined(YAPD_CPU_AVX2) || defined(YAPD_CPU_SSE2)
+    const __m128 t4 = _mm_set1_ps(t);
+    for (; i + 4 <= n; i += 4) {
+        const __m128 a4 = _mm_loadu_ps(a + i);
+        const __m128 d4 = _mm_sub_ps(_mm_loadu_ps(b + i), a4);
+        _mm_storeu_ps(dst + i, _mm_add_ps(a4, _mm_mul_ps(d4, t4)));
+    }
+#endif
+    for (; i < n; ++i) dst[i] = a[i] + (b[i] - a[i])*t;
+}
+
+// half float bits of `f`, rounded to nearest even as vstore_half().
+static YAPD_INLINE uint16_t
+yapd_cpu_float_to_half(
+    float f)
+{
+    uint32_t u, e, m, s;
+    memcpy(&u, &f, sizeof(u));
+    s = (u >> 16) & 0x8000u;
+    u &= 0x7fffffffu;
+    if (u >= 0x7f800000u) { // inf or nan
+        return (uint16_t)(s | 0x7c00u | (u > 0x7f800000u ? 0x200u : 0));
+    }
+    if (u >= 0x477ff000u) return (uint16_t)(s | 0x7c00u); // overflow
+    if (u < 0x38800000u) { // subnormal
+        if (u < 0x33000000u) return (uint16_t)s;
+        e = u >> 23;
+        m = (u & 0x7fffffu) | 0x800000u;
+        u = m >> (126 - e);
+        m &= (1u << (126 - e)) - 1;
+        if (m > (1u << (125 - e)) || (m == (1u << (125 - e)) && (u & 1))) {
+            ++u;
+        }
+        return (uint16_t)(s | u);
+    }
+    e = u - 0x38000000u; // rebias exponent
+    m = e & 0x1fffu;
+    e >>= 13;
+    if (m > 0x1000u || (m == 0x1000u && (e & 1))) ++e;
+    return (uint16_t)(s | e);
+}
+
+// float of half float bits `h`, same as vload_half().
+static YAPD_INLINE float
+yapd_cpu_half_to_float(
+    uint16_t h)
+{
+    float f;
+    uint32_t u;
+    const uint32_t s = (uint32_t)(h & 0x8000u) << 16;
+    const uint32_t e = (h >> 10) & 0x1fu;
+    uint32_t m = h & 0x3ffu;
+    if (e == 0x1fu) {
+        u = s | 0x7f800000u | (m << 13);
+    } else if (e != 0) {
+        u = s | ((e + 112) << 23) | (m << 13);
+    } else if (m == 0) {
+        u = s;
+    } else { // subnormal
+        int k = 0;
+        while (!(m & 0x400u)) { m <<= 1; ++k; }
+        u = s | ((uint32_t)(113 - k) << 23) | ((m & 0x3ffu) << 13);
+    }
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+void
+yapd_cpu_setup(
+    yapd_gpu_t* gpu, int num_threads);
+
+void
+yapd_cpu_luv_from_rgb8uc4(
+    yapd_gpu_t* gpu, float* dst, const uint8_t* src, int n);
+
+void
+yapd_cpu_luv_resample_rgb8uc4(
+    yapd_gpu_t* gpu, float* dst, const yapd_size_t* dst_sz,
+    const uint8_t* src, const yapd_size_t* src_sz);
+
+void
+yapd_cpu_conv_tri_cols(
+    yapd_gpu_t* gpu, int channels, int r, const float* filter,
+    const yapd_size_t* sz, float* dst, const float* src);
+
+void
+yapd_cpu_conv_tri_rows(
+    yapd_gpu_t* gpu, int channels, int r, const float* filter,
+    const yapd_size_t* sz, float* dst, const float* src);
+
+void
+yapd_cpu_conv_tri_sum_cols(
+    yapd_gpu_t* gpu, int channels, int r,
+    const yapd_size_t* sz, float* dst, const float* src);
+
+void
+yapd_cpu_conv_tri_sum_rows(
+    yapd_gpu_t* gpu, int channels, int r,
+    const yapd_size_t* sz, float* dst, const float* src);
+
+void
+yapd_cpu_resample(
+    yapd_gpu_t* gpu, int channels, int lanes,
+    float* dst, int dst_pitch, int dst_cell, const yapd_size_t* dst_sz,
+    const float* src, const yapd_size_t* src_sz, float norm);
+
+void
+yapd_cpu_downsample(
+    yapd_gpu_t* gpu, int channels,
+    float* dst, const yapd_size_t* dst_sz,
+    const float* src, const yapd_size_t* src_sz);
+
+void
+yapd_cpu_grad_mag32fc4(
+    yapd_gpu_t* gpu, const float* img, const yapd_size_t* sz,
+    float* mag, float* angle);
+
+void
+yapd_cpu_grad_mag_norm(
+    yapd_gpu_t* gpu, float* mag, const float* nrm,
+    const yapd_size_t* sz, float nrm_const);
+
+void
+yapd_cpu_grad_norm_hist32fc4(
+    yapd_gpu_t* gpu, float* hist, int hist_pitch, int hist_cell,
+    int hist_lanes, const float* img, float* mag,
+    const float* nrm, const yapd_size_t* sz, float nrm_const, float scale,
+    int bin_size, int num_orients, const float* acos_lut, int lut_size);
+
+void
+yapd_cpu_grad_scale_angle(
+    yapd_gpu_t* gpu, float* angle, const yapd_size_t* sz, float scale);
+
+void
+yapd_cpu_grad_hist(
+    yapd_gpu_t* gpu, float* hist, const float* mag, const float* angle,
+    const yapd_size_t* sz, int bin_size, int num_orients);
+
+void
+yapd_cpu_pyramid_border(
+    yapd_gpu_t* gpu, float* dst, int cell, const yapd_size_t* sz,
+    const yapd_size_t* pad);
+
+void
+yapd_cpu_pyramid_approx(
+    yapd_gpu_t* gpu, float* dst, int cell, const yapd_pyramid_level_t* lv,
+    const yapd_size_t* pad, const float* src);
+
+void
+yapd_cpu_pyramid_pack(
+    yapd_gpu_t* gpu, void* dst, int storage, const float* src, int cell,
+    const float* quant, int n);
+
+void
+yapd_cpu_pyramid_unpack(
+    yapd_gpu_t* gpu, float* dst, int storage, const void* src, int cell,
+    const float* quant, int n);
+
+// windows far from survivors of `coarse_out`, a grid `coarse` times
+// sparser than `dims`, are rejected at `casc_thr`, NULL evaluates all.
+void
+yapd_cpu_detector_early_reject(
+    yapd_gpu_t* gpu, const yapd_detector_t* d, const void* chns,
+    int to_org, int org_w, float casc_thr,
+    const yapd_size_t* dims, float* out,
+    const float* coarse_out, int coarse, float coarse_thr);
+
+void
+yapd_cpu_detector_predict(
+    yapd_gpu_t* gpu, const yapd_detector_t* d, const void* chns,
+    int to_org, int org_w, int bbs_sz, float* bbs);
@@ -0,0 +1,104 @@
+/* Copyright (c) 2018 Giang "Yakiro" Nguyen. All rights reserved. */
+#include <cpu/cpu.h>
+
+// child (1 or 2) of node `n` for window at `off` of cells at `chns` in rows
+// of `row` floats, stored as d->storage, bytes are compared to quantized
+// thresholds.
+static YAPD_INLINE int
+child(
+    const yapd_detector_t* d, const yapd_detector_node_t* n,
+    const void* chns, int off, int row)
+{
+    const int i = off + (n->fid >> 16)*row + (n->fid & 0xffff);
+    switch (d->storage) {
+    case YAPD_FEATURE_HALF:
+        return yapd_cpu_half_to_float(((const uint16_t*)chns)[i]) < n->thr
+            ? 1 : 2;
+    case YAPD_FEATURE_U8:
+        return ((const uint8_t*)chns)[i] < n->qthr ? 1 : 2;
+    default:
+        return ((const float*)chns)[i] < n->thr ? 1 : 2;
+    }
+}
+
+static YAPD_INLINE float
+tree(
+    const yapd_detector_t* d, const void* chns, int off, int row, int t)
+{
+    int i, k = 0;
+    const yapd_detector_node_t* const nodes =
+        d->nodes_host + t*YAPD_DETECTOR_TREE_NODES;
+    for (i = 0; i < d->depth; ++i) {
+        k = k*2 + child(d, nodes + k, chns, off, row);
+    }
+    return nodes[k].h;
+}
+
+// same as near_coarse of detector.cl.
+static YAPD_INLINE int
+near_coarse(
+    const float* coarse_out, int coarse, float coarse_thr,
+    const yapd_size_t* dims, int x, int y)
+{
+    const int w = (dims->w + coarse - 1) / coarse;
+    const int h = (dims->h + coarse - 1) / coarse;
+    const int lx = x / coarse, ly = y / coarse;
+    const int hx = YAPD_MIN((x + coarse - 1) / coarse, w - 1);
+    const int hy = YAPD_MIN((y + coarse - 1) / coarse, h - 1);
+    return
+        coarse_out[ly*w + lx] > coarse_thr ||
+        coarse_out[ly*w + hx] > coarse_thr ||
+        coarse_out[hy*w + lx] > coarse_thr ||
+        coarse_out[hy*w + hx] > coarse_thr;
+}
+
+void
+yapd_cpu_detector_early_reject(
+    yapd_gpu_t* gpu, const yapd_detector_t* d, const void* chns,
+    int to_org, int org_w, float casc_thr,
+    const yapd_size_t* dims, float* out,
+    const float* coarse_out, int coarse, float coarse_thr)
+{
+    int y;
+    const int row = org_w*d->cell;
+    const int num_weaks = d->stages[0];
+    // windows around objects survive longer, balance them dynamically
+#pragma omp parallel for schedule(dynamic) num_threads(gpu->cpu.num_threads)
+    for (y = 0; y < dims->h; ++y) {
+        int x, t;
+        for (x = 0; x < dims->w; ++x) {
+            const int off = (y*to_org*org_w + x*to_org)*d->cell;
+            float h = 0.0f;
+            if (coarse_out && !near_coarse(
+                    coarse_out, coarse, coarse_thr, dims, x, y)) {
+                out[y*dims->w + x] = casc_thr;
+                continue;
+            }
+            for (t = 0; t < num_weaks; ++t) {
+                h += tree(d, chns, off, row, t); if (h <= casc_thr) break;
+            }
+            out[y*dims->w + x] = h;
+        }
+    }
+}
+
+void
+yapd_cpu_detector_predict(
+    yapd_gpu_t* gpu, const yapd_detector_t* d, const void* chns,
+    int to_org, int org_w, int bbs_sz, float* bbs)
+{
+    int i;
+    const int row = org_w*d->cell;
+#pragma omp parallel for schedule(dynamic) num_threads(gpu->cpu.num_threads)
+    for (i = 0; i < bbs_sz; ++i) {
+        int t;
+        float* const b = bbs + i*5;
+        const int x = (int)b[0]*to_org;
+        const int y = (int)b[1]*to_org;
+        const int off = (y*org_w + x)*d->cell;
+        b[4] = tree(d, chns, off, row, 0);
+        for (t = 1; t < d->num_weaks; ++t) {
+            b[4] += tree(d, chns, off, row, t); if (b[4] <= -1) break;
+        }
+    }
+}
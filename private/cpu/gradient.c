@@ -0,0 +1,159 @@
+/* Copyright (c) 2018 Giang "Yakiro" Nguyen. All rights reserved. */
+#include <cpu/cpu.h>
+
+// gradient of the channel with max magnitude, returns squared magnitude
+static float
+grad32fc4(
+    const float* img, int x, int y, const yapd_size_t* sz,
+    float* dx, float* dy)
+{
+    int c;
+    const int w = sz->w;
+    const float* const t = img + yapd_cpu_border(y - 1, sz->h)*w*4 + x*4;
+    const float* const b = img + yapd_cpu_border(y + 1, sz->h)*w*4 + x*4;
+    const float* const m = img + y*w*4;
+    const float* const l = m + yapd_cpu_border(x - 1, w)*4;
+    const float* const r = m + yapd_cpu_border(x + 1, w)*4;
+    float mag2 = -1;
+    for (c = 0; c < 3; ++c) {
+        const float cdx = (r[c] - l[c])*0.5f;
+        const float cdy = (b[c] - t[c])*0.5f;
+        const float cmag2 = cdx*cdx + cdy*cdy;
+        // the kernel keeps the last channel on ties
+        if (c == 0 || cmag2 >= mag2) {
+            *dx = cdx; *dy = cdy; mag2 = cmag2;
+        }
+    }
+    return mag2;
+}
+
+static float
+grad_angle(
+    float m, float dx, float dy)
+{
+    const float o = m == 0 ? 0 : atan2f(dy, dx);
+    return o < 0 ? CL_M_PI_F + o : o;
+}
+
+static float
+grad_angle_lut(
+    const float* lut, int lut_size, float mag2, float dx, float dy)
+{
+    int i;
+    if (mag2 == 0) return 0;
+    i = (int)(((dy < 0 ? -dx : dx) / sqrtf(mag2) + 1.0f)*0.5f*(lut_size - 1)
+        + 0.5f);
+    return lut[YAPD_MIN(YAPD_MAX(i, 0), lut_size - 1)];
+}
+
+void
+yapd_cpu_grad_mag32fc4(
+    yapd_gpu_t* gpu, const float* img, const yapd_size_t* sz,
+    float* mag, float* angle)
+{
+    int y;
+    const int w = sz->w;
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (y = 0; y < sz->h; ++y) {
+        int x;
+        for (x = 0; x < w; ++x) {
+            const int idx = y*w + x;
+            float dx, dy;
+            mag[idx] = sqrtf(grad32fc4(img, x, y, sz, &dx, &dy));
+            if (angle) angle[idx] = grad_angle(mag[idx], dx, dy);
+        }
+    }
+}
+
+void
+yapd_cpu_grad_mag_norm(
+    yapd_gpu_t* gpu, float* mag, const float* nrm,
+    const yapd_size_t* sz, float nrm_const)
+{
+    int i;
+    const int n = sz->w*sz->h;
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (i = 0; i < n; ++i) {
+        mag[i] = mag[i] / (nrm[i] + nrm_const);
+    }
+}
+
+void
+yapd_cpu_grad_scale_angle(
+    yapd_gpu_t* gpu, float* angle, const yapd_size_t* sz, float scale)
+{
+    yapd_cpu_mul(angle, angle, scale, sz->w*sz->h);
+}
+
+void
+yapd_cpu_grad_hist(
+    yapd_gpu_t* gpu, float* hist, const float* mag, const float* angle,
+    const yapd_size_t* sz, int bin_size, int num_orients)
+{
+    int py;
+    const int w0 = sz->w*bin_size;
+    const float nrm = 1.0f / (bin_size*bin_size);
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (py = 0; py < sz->h; ++py) {
+        int px, x, y;
+        for (px = 0; px < sz->w; ++px) {
+            float* const h = hist + (py*sz->w + px)*8;
+            memset(h, 0, sizeof(float)*8);
+            for (y = 0; y < bin_size; ++y) {
+                for (x = 0; x < bin_size; ++x) {
+                    const int idx = (py*bin_size + y)*w0 + px*bin_size + x;
+                    const float o = angle[idx];
+                    const int io0 = (int)o;
+                    const float od = o - io0;
+                    const int o0 = io0 % num_orients;
+                    const int o1 = (o0 + 1) % num_orients;
+                    const float m = mag[idx]*nrm;
+                    const float m1 = od*m;
+                    h[o0] += m - m1;
+                    h[o1] += m1;
+                }
+            }
+        }
+    }
+}
+
+// `hist_pitch` and `hist_cell` are in floats, `hist_lanes` of 8 are written.
+void
+yapd_cpu_grad_norm_hist32fc4(
+    yapd_gpu_t* gpu, float* hist, int hist_pitch, int hist_cell,
+    int hist_lanes, const float* img, float* mag,
+    const float* nrm, const yapd_size_t* sz, float nrm_const, float scale,
+    int bin_size, int num_orients, const float* acos_lut, int lut_size)
+{
+    int py;
+    const yapd_size_t sz0 = { sz->w*bin_size, sz->h*bin_size };
+    const float nrm_cell = 1.0f / (bin_size*bin_size);
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (py = 0; py < sz->h; ++py) {
+        int px, x, y;
+        for (px = 0; px < sz->w; ++px) {
+            float* const h = hist + py*hist_pitch + px*hist_cell;
+            memset(h, 0, sizeof(float)*hist_lanes);
+            for (y = py*bin_size; y < (py + 1)*bin_size; ++y) {
+                for (x = px*bin_size; x < (px + 1)*bin_size; ++x) {
+                    const int idx = y*sz0.w + x;
+                    float dx, dy;
+                    const float mag2 = grad32fc4(img, x, y, &sz0, &dx, &dy);
+                    const float mn = mag[idx] / (nrm[idx] + nrm_const);
+                    mag[idx] = mn;
+                    const float o = scale*(lut_size > 0 ?
+                        grad_angle_lut(acos_lut, lut_size, mag2, dx, dy) :
+                        grad_angle(mn, dx, dy));
+                    const int io0 = (int)o;
+                    const float od = o - io0;
+                    const int o0 = io0 % num_orients;
+                    const int o1 = (o0 + 1) % num_orients;
+                    const float m = mn*nrm_cell;
+                    const float m1 = od*m;
+                    h[o0] += m - m1;
+                    h[o1] += m1;
+                }
+            }
+        }
+    }
+}
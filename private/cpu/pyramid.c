@@ -0,0 +1,122 @@
+/* Copyright (c) 2018 Giang "Yakiro" Nguyen. All rights reserved. */
+#include <cpu/cpu.h>
+
+void
+yapd_cpu_pyramid_border(
+    yapd_gpu_t* gpu, float* dst, int cell, const yapd_size_t* sz,
+    const yapd_size_t* pad)
+{
+    int y;
+    const int pad_w = sz->w + 2*pad->w;
+    const int pad_h = sz->h + 2*pad->h;
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (y = 0; y < pad_h; ++y) {
+        int x;
+        const int oy = y - pad->h;
+        const int ny = YAPD_MIN(YAPD_MAX(oy, 0), sz->h - 1);
+        for (x = 0; x < pad_w; ++x) {
+            float* const o = dst + (y*pad_w + x)*cell;
+            const int ox = x - pad->w;
+            const int nx = YAPD_MIN(YAPD_MAX(ox, 0), sz->w - 1);
+            if (nx == ox && ny == oy) {
+                x = pad_w - pad->w - 1; // skip to right border
+                continue;
+            }
+            memcpy(
+                o, dst + ((ny + pad->h)*pad_w + nx + pad->w)*cell,
+                sizeof(float)*3);
+            memset(o + 3, 0, sizeof(float)*(cell - 3));
+        }
+    }
+}
+
+// `src` points to first pixel inside padded features of real scale, cells
+// are float16 or compact ones of YAPD_FEATURE_COMPACT_CHANNELS floats.
+void
+yapd_cpu_pyramid_approx(
+    yapd_gpu_t* gpu, float* dst, int cell, const yapd_pyramid_level_t* lv,
+    const yapd_size_t* pad, const float* src)
+{
+    int y;
+    const yapd_size_t sz = { lv->sz.s[0], lv->sz.s[1] };
+    const yapd_size_t src_sz = { lv->src_sz.s[0], lv->src_sz.s[1] };
+    const int pad_w = sz.w + 2*pad->w;
+    const int pad_h = sz.h + 2*pad->h;
+    const int src_w = src_sz.w + 2*pad->w;
+    const int mag = cell == YAPD_FEATURE_CHANNELS ? 4 : 3;
+    const int hist = cell == YAPD_FEATURE_CHANNELS ? 8 : 4;
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (y = 0; y < pad_h; ++y) {
+        int x;
+        float c0[16], c1[16], c[16];
+        const int oy = y - pad->h;
+        const int ny = YAPD_MIN(YAPD_MAX(oy, 0), sz.h - 1);
+        const float gy = ny / (float)sz.h * (src_sz.h - 1);
+        const int gyi = (int)gy;
+        const float ty = gy - gyi;
+        for (x = 0; x < pad_w; ++x) {
+            float* const o = dst + (y*pad_w + x)*cell;
+            const int ox = x - pad->w;
+            const int nx = YAPD_MIN(YAPD_MAX(ox, 0), sz.w - 1);
+            const float gx = nx / (float)sz.w * (src_sz.w - 1);
+            const int gxi = (int)gx;
+            const float tx = gx - gxi;
+            const float* const s0 = src + (gyi*src_w + gxi)*cell;
+            const float* const s1 = s0 + src_w*cell;
+            yapd_cpu_mix(c0, s0, s0 + cell, tx, cell);
+            yapd_cpu_mix(c1, s1, s1 + cell, tx, cell);
+            yapd_cpu_mix(c, c0, c1, ty, cell);
+            memset(o, 0, sizeof(float)*cell);
+            yapd_cpu_mul(o, c, lv->ratio.s[0], 3);
+            if (nx == ox && ny == oy) {
+                o[mag] = c[mag]*lv->ratio.s[1];
+                yapd_cpu_mul(o + hist, c + hist, lv->ratio.s[2], cell - hist);
+            }
+        }
+    }
+}
+
+// `n` float cells of `src` into slot `dst` stored as `storage`, bytes are
+// quantized by `quant` of each lane as store_slot() of pyramid.cl.
+void
+yapd_cpu_pyramid_pack(
+    yapd_gpu_t* gpu, void* dst, int storage, const float* src, int cell,
+    const float* quant, int n)
+{
+    int i;
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (i = 0; i < n; ++i) {
+        int z;
+        const float* const s = src + i*cell;
+        if (storage == YAPD_FEATURE_HALF) {
+            uint16_t* const o = (uint16_t*)dst + i*cell;
+            for (z = 0; z < cell; ++z) o[z] = yapd_cpu_float_to_half(s[z]);
+        } else {
+            uint8_t* const o = (uint8_t*)dst + i*cell;
+            for (z = 0; z < cell; ++z) {
+                const float b = rintf(s[z]*quant[z]);
+                o[z] = (uint8_t)(b < 0 ? 0 : b > 255 ? 255 : b);
+            }
+        }
+    }
+}
+
+void
+yapd_cpu_pyramid_unpack(
+    yapd_gpu_t* gpu, float* dst, int storage, const void* src, int cell,
+    const float* quant, int n)
+{
+    int i;
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (i = 0; i < n; ++i) {
+        int z;
+        float* const o = dst + i*cell;
+        if (storage == YAPD_FEATURE_HALF) {
+            const uint16_t* const s = (const uint16_t*)src + i*cell;
+            for (z = 0; z < cell; ++z) o[z] = yapd_cpu_half_to_float(s[z]);
+        } else {
+            const uint8_t* const s = (const uint8_t*)src + i*cell;
+            for (z = 0; z < cell; ++z) o[z] = s[z] / quant[z];
+        }
+    }
+}
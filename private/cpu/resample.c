@@ -0,0 +1,73 @@
+/* Copyright (c) 2018 Giang "Yakiro" Nguyen. All rights reserved. */
+#include <cpu/cpu.h>
+
+// `dst_pitch` and `dst_cell` are in floats, only first `lanes` channels
+// are written if the cell has no room for all of them.
+void
+yapd_cpu_resample(
+    yapd_gpu_t* gpu, int channels, int lanes,
+    float* dst, int dst_pitch, int dst_cell, const yapd_size_t* dst_sz,
+    const float* src, const yapd_size_t* src_sz, float norm)
+{
+    int y;
+    const int src_row = src_sz->w*channels;
+    assert(channels <= 16);
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (y = 0; y < dst_sz->h; ++y) {
+        int x;
+        float c0[16], c1[16];
+        const float gy = y / (float)dst_sz->h * (src_sz->h - 1);
+        const int gyi = (int)gy;
+        const float ty = gy - gyi;
+        const float* const s0 = src + gyi*src_row;
+        const float* const s1 = s0 + src_row;
+        float* o = dst + y*dst_pitch;
+        for (x = 0; x < dst_sz->w; ++x, o += dst_cell) {
+            const float gx = x / (float)dst_sz->w * (src_sz->w - 1);
+            const int gxi = (int)gx;
+            const float tx = gx - gxi;
+            const int i = gxi*channels;
+            yapd_cpu_mix(c0, s0 + i, s0 + i + channels, tx, channels);
+            yapd_cpu_mix(c1, s1 + i, s1 + i + channels, tx, channels);
+            yapd_cpu_mix(o, c0, c1, ty, lanes);
+            if (norm != 1.0f) yapd_cpu_mul(o, o, norm, lanes);
+        }
+    }
+}
+
+void
+yapd_cpu_downsample(
+    yapd_gpu_t* gpu, int channels,
+    float* dst, const yapd_size_t* dst_sz,
+    const float* src, const yapd_size_t* src_sz)
+{
+    int y;
+    const int src_row = src_sz->w*channels;
+    const float sx = src_sz->w / (float)dst_sz->w;
+    const float sy = src_sz->h / (float)dst_sz->h;
+    assert(channels <= 16);
+#pragma omp parallel for num_threads(gpu->cpu.num_threads)
+    for (y = 0; y < dst_sz->h; ++y) {
+        int x;
+        float c0[16], c1[16];
+        const float gy = YAPD_MIN(
+            YAPD_MAX((y + 0.5f)*sy - 0.5f, 0.0f), src_sz->h - 1.0f);
+        const int gyi = (int)gy;
+        const float ty = gy - gyi;
+        const float* const s0 = src + gyi*src_row;
+        const float* const s1 = src +
+            YAPD_MIN(gyi + 1, src_sz->h - 1)*src_row;
+        float* o = dst + y*dst_sz->w*channels;
+        for (x = 0; x < dst_sz->w; ++x, o += channels) {
+            const float gx = YAPD_MIN(
+                YAPD_MAX((x + 0.5f)*sx - 0.5f, 0.0f), src_sz->w - 1.0f);
+            const int gxi = (int)gx;
+            const float tx = gx - gxi;
+            const int i0 = gxi*channels;
+            const int i1 = YAPD_MIN(gxi + 1, src_sz->w - 1)*channels;
+            yapd_cpu_mix(c0, s0 + i0, s0 + i1, tx, channels);
+            yapd_cpu_mix(c1, s1 + i0, s1 + i1, tx, channels);
+            yapd_cpu_mix(o, c0, c1, ty, channels);
+        }
+    }
+}
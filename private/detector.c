@@ -5,321 +5,583 @@
 #include <yapd/matrix.h>
 #include <yapd/buffer.h>
 #include <yapd/nms.h>
+#include <cpu/cpu.h>
 #include <detector.cl.h>
 
+#include <stdio.h>
+
+// packed nodes of the classifier for features of pyramid `p`. Model
+// features are indexed by channel of float16 cells, then column and row of
+// the window, they are decomposed into row and offset in row of `d->cell`
+// floats cells, so that kernels need only the row pitch of each scale. For
+// bytes, a feature is below threshold `t` if its byte is at most
+// floor(t*quant).
 static void
-compute_cids(
-    yapd_alloc_t a, void* aud,
-    const yapd_size_t* win_sz, int shrink,
-    const yapd_size_t* sz, int** cids_host, yapd_buffer_t* cids)
+pack_nodes(
+    yapd_detector_t* d, const yapd_pyramid_t* p)
 {
-    int x, y, z, m = 0;
-    const int mw = win_sz->w / shrink;
-    const int mh = win_sz->h / shrink;
-    const int nftrs = mw * mh * YAPD_FEATURE_CHANNELS;
-    const int bytes = nftrs * sizeof(int);
-    a.dealloc(aud, *cids_host);
-    *cids_host = (int*)a.alloc(aud, bytes, YAPD_DEFAULT_ALIGN);
-    for (z = 0; z < YAPD_FEATURE_CHANNELS; ++z) {
-        for (x = 0; x < mw; ++x) {
-            for (y = 0; y < mh; ++y) {
-                (*cids_host)[m++] = (y*sz->w + x)*YAPD_FEATURE_CHANNELS + z;
-            }
-        }
+    // compact channel of each float16 lane, -1 for lanes always zero
+    static const int compact[] = {
+        0, 1, 2, -1, 3, -1, -1, -1, 4, 5, 6, 7, 8, 9, -1, -1
+    };
+    int i;
+    const int mh = d->win_sz.h / d->shrink;
+    const int n = (d->win_sz.w / d->shrink) * mh;
+    const float* const thrs = (const float*)d->thrs_host.data;
+    const int* const fids = (const int*)d->fids_host.data;
+    const float* const hs = (const float*)d->hs_host.data;
+    const float* const quant = p->opts.quant;
+    const int num_nodes = YAPD_DETECTOR_TREE_NODES*
+        YAPD_MAX(d->num_weaks, YAPD_DETECTOR_EARLY_WEAKS);
+    const int bytes = sizeof(yapd_detector_node_t)*num_nodes;
+    YAPD_STATIC_ASSERT(
+        YAPD_STATIC_ARRAY_COUNT(compact) == YAPD_FEATURE_CHANNELS);
+    YAPD_STATIC_ASSERT(sizeof(yapd_detector_node_t) == sizeof(cl_int4));
+    d->a.dealloc(d->aud, d->nodes_host);
+    d->nodes_host = (yapd_detector_node_t*)d->a.alloc(
+        d->aud, bytes, YAPD_DEFAULT_ALIGN);
+    memset(d->nodes_host, 0, bytes);
+    for (i = 0; i < d->num_weaks*YAPD_DETECTOR_TREE_NODES; ++i) {
+        yapd_detector_node_t* const o = d->nodes_host + i;
+        const int z = fids[i] / n;
+        const float q =
+            z < 3 ? quant[0] : z == 4 ? quant[1] : z >= 8 ? quant[2] : 1.0f;
+        const float t = floorf(thrs[i]*q) + 1.0f;
+        const int x = fids[i] % n / mh;
+        const int y = fids[i] % n % mh;
+        const int c = d->cell == YAPD_FEATURE_CHANNELS ? z : compact[z];
+        assert(z >= 0 && z < YAPD_FEATURE_CHANNELS && c >= 0);
+        o->fid = (y << 16) | (x*d->cell + c);
+        o->thr = thrs[i];
+        o->qthr = (int)YAPD_MIN(YAPD_MAX(t, 0.0f), 256.0f);
+        o->h = hs[i];
     }
-    yapd_buffer_reserve(cids, bytes);
-    yapd_buffer_upload(cids, (uint8_t*)*cids_host, bytes);
+    yapd_buffer_reserve(&d->nodes, bytes);
+    yapd_buffer_upload(&d->nodes, (uint8_t*)d->nodes_host, bytes);
 }
 
 static void
-release_cids(
-    yapd_detector_t* d)
+output_dims(
+    yapd_size_t* dims, int shrink, int stride,
+    const yapd_size_t* win_sz, const yapd_size_t* sz)
 {
-    int i;
-    d->a.dealloc(d->aud, d->sizes);
-    d->sizes = NULL;
-    for (i = 0; i < d->num_scales; ++i) {
-        d->a.dealloc(d->aud, d->cids_host[i]);
-        yapd_buffer_release(d->cids + i);
-    }
-    d->a.dealloc(d->aud, d->cids_host);
-    d->cids_host = NULL;
-    d->a.dealloc(d->aud, d->cids);
-    d->cids = NULL;
+    dims->w = (int)ceilf(
+        (sz->w*shrink - win_sz->w + 1) / (float)stride);
+    dims->h = (int)ceilf(
+        (sz->h*shrink - win_sz->h + 1) / (float)stride);
 }
 
-static void
-alloc(
-    yapd_detector_t* d, int num_scales)
+enum { WIN_TILE_W = 8, WIN_TILE_H = 8 };
+// same as detector.cl, a work-group scans two ints per work-item
+enum { SCAN_GROUP = 128, SCAN_BLOCK = 2*SCAN_GROUP };
+// persistent work-groups of predict per compute unit
+enum { PREDICT_GROUP = 64, PREDICT_RESIDENT = 8 };
+
+static int
+feature_bytes(
+    int storage)
 {
-    int i;
-    release_cids(d);
-    d->num_scales = num_scales;
-    d->sizes = (yapd_size_t*)d->a.alloc(
-        d->aud, sizeof(yapd_size_t)*num_scales, YAPD_DEFAULT_ALIGN);
-    d->cids_host = (int**)d->a.alloc(
-        d->aud, sizeof(int*)*num_scales, YAPD_DEFAULT_ALIGN);
-    d->cids = (yapd_buffer_t*)d->a.alloc(
-        d->aud, sizeof(yapd_buffer_t)*num_scales, YAPD_DEFAULT_ALIGN);
-    for (i = 0; i < num_scales; ++i) {
-        d->sizes[i].w = -1;
-        d->sizes[i].h = -1;
-        d->cids_host[i] = NULL;
-        d->cids[i] = yapd_buffer_readonly(d->gpu, 0);
-    }
+    return storage == YAPD_FEATURE_U8 ? 1 :
+        storage == YAPD_FEATURE_HALF ? 2 : (int)sizeof(float);
 }
 
+// descriptors of scales of `p` followed by a sentinel of totals into
+// `host` and `buf`, they are uploaded only when layout of the pyramid or
+// stride changes.
 static void
-reserve(
-    yapd_detector_t* d, const yapd_size_t* sizes, int num_scales)
+describe_scales(
+    yapd_detector_t* d, const yapd_pyramid_t* p, int stride,
+    int* num, yapd_detector_scale_t** host, yapd_buffer_t* buf)
 {
-    int i;
-    if (d->num_scales != num_scales) {
-        alloc(d, num_scales);
-    }
-    for (i = 0; i < num_scales; ++i) {
-        if (!yapd_size_equals(d->sizes + i, sizes + i)) {
-            compute_cids(
-                d->a, d->aud, &d->win_sz, d->shrink,
-                sizes + i, d->cids_host + i, d->cids + i);
-            d->sizes[i] = sizes[i];
-        }
+    int i, changed;
+    const int n = p->num_scales;
+    const int bytes = sizeof(yapd_detector_scale_t)*(n + 1);
+    const int elem = feature_bytes(p->opts.storage);
+    yapd_detector_scale_t* s = (yapd_detector_scale_t*)d->a.alloc(
+        d->aud, bytes, YAPD_DEFAULT_ALIGN);
+    memset(s, 0, bytes);
+    for (i = 0; i < n; ++i) {
+        yapd_size_t dims;
+        output_dims(&dims, d->shrink, stride, &d->win_sz, p->data_sz + i);
+        assert(dims.w > 0 && dims.h > 0);
+        assert(p->slot_off[i] % elem == 0);
+        s[i].chns_off = p->slot_off[i] / elem;
+        s[i].org_w = p->data_sz[i].w;
+        s[i].org_h = p->data_sz[i].h;
+        s[i].out_w = dims.w;
+        s[i].out_h = dims.h;
+        s[i + 1].out_off = s[i].out_off + dims.w*dims.h;
+        s[i + 1].group_off = s[i].group_off +
+            (dims.w + WIN_TILE_W - 1) / WIN_TILE_W*
+            ((dims.h + WIN_TILE_H - 1) / WIN_TILE_H);
     }
+    changed = n != *num || memcmp(s, *host, bytes) != 0;
+    d->a.dealloc(d->aud, *host);
+    *host = s;
+    *num = n;
+    if (!changed) return;
+    yapd_buffer_reserve(buf, bytes);
+    yapd_buffer_upload(buf, (uint8_t*)s, bytes);
 }
 
-static void
-output_dims(
-    yapd_size_t* dims, int shrink, int stride,
-    const yapd_size_t* win_sz, const yapd_size_t* sz)
+// picks the tiled kernel if the feature tile of a work-group of windows and
+// the early trees fit in local memory, then sets its local argument. Global
+// size is rounded up to the work-group size. A 16x32 cells window at
+// to_org 1 makes a 23x39 cells tile, about 56 KB for float16 cells, so
+// with 48 KB of local memory full float storage falls back to the untiled
+// kernel, compact (35 KB), half and u8 tiles fit.
+static cl_kernel
+pick(
+    yapd_gpu_t* gpu, cl_kernel kernel, cl_kernel tiled, int tile_arg,
+    int to_org, int cell, int storage, const yapd_size_t* win,
+    const yapd_detector_scale_t* total, size_t* size, const size_t** local)
 {
-    dims->w = (int)ceilf(
-        (sz->w*shrink - win_sz->w + 1) / (float)stride);
-    dims->h = (int)ceilf(
-        (sz->h*shrink - win_sz->h + 1) / (float)stride);
+    cl_int err;
+    static const size_t tile[] = { WIN_TILE_W*WIN_TILE_H, 1, 1 };
+    const size_t group = WIN_TILE_W*WIN_TILE_H;
+    const size_t bytes = feature_bytes(storage)*cell*
+        ((WIN_TILE_W - 1)*to_org + win->w)*((WIN_TILE_H - 1)*to_org + win->h);
+    const size_t nodes = sizeof(yapd_detector_node_t)*
+        YAPD_DETECTOR_EARLY_WEAKS*YAPD_DETECTOR_TREE_NODES;
+    yapd_gpu_detector_ctx_t* c = &gpu->detector;
+    size[0] = (total->out_off + group - 1) / group * group;
+    size[1] = 1;
+    size[2] = 1;
+    *local = NULL;
+    if (!tiled || !c->tiled || bytes + nodes > c->local_mem) return kernel;
+    size[0] = total->group_off*group;
+    *local = tile;
+    err = clSetKernelArg(tiled, tile_arg, bytes, NULL);
+    assert(err == CL_SUCCESS);
+    return tiled;
 }
 
+// windows of all scales in a single launch, `win` is the window size in
+// cells. With `coarse` > 0, only windows near survivors of `coarse_out`
+// are evaluated.
 static void
 early_reject(
-    yapd_gpu_t* gpu, yapd_buffer_t* chns, yapd_buffer_t* cids,
-    int depth, int to_org, int out_off, int org_w, float casc_thr,
-    const yapd_size_t* dims, yapd_buffer_t* out, yapd_buffer_t* idx,
-    yapd_buffer_t* thrs, yapd_buffer_t* hs, yapd_buffer_t* fids)
+    yapd_gpu_t* gpu, cl_kernel kernel, cl_kernel tiled, yapd_buffer_t* chns,
+    int depth, int to_org, int num_scales,
+    const yapd_detector_scale_t* scales_host, const yapd_size_t* win,
+    int cell, int storage, float casc_thr, yapd_buffer_t* scales,
+    yapd_buffer_t* out, yapd_buffer_t* idx, yapd_buffer_t* nodes,
+    int num_early, int coarse, yapd_buffer_t* coarse_scales,
+    yapd_buffer_t* coarse_out, float coarse_thr)
 {
     cl_int err;
+    cl_kernel k;
+    cl_int2 win_sz;
+    int arg;
     size_t offset[] = { 0, 0, 0 };
-    size_t size[] = { dims->w, dims->h, 1 };
-    yapd_gpu_detector_ctx_t* dc = &gpu->detector;
+    size_t size[3];
+    const size_t* local;
+    const yapd_detector_scale_t* total = scales_host + num_scales;
 
-    assert(out->bytes >= (dims->w*dims->h + out_off) * sizeof(float));
-    assert(idx->bytes >= (dims->w*dims->h + out_off) * sizeof(int));
+    assert(out->bytes >= total->out_off * sizeof(float));
+    assert(idx->bytes >= total->out_off * sizeof(int));
 
-    err = clSetKernelArg(dc->early_reject, 0, sizeof(int), &depth);
+    k = pick(
+        gpu, kernel, tiled, 12, to_org, cell, storage, win, total,
+        size, &local);
+    err = clSetKernelArg(k, 0, sizeof(int), &depth);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 1, sizeof(int), &to_org);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 2, sizeof(int), &num_scales);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 3, sizeof(cl_mem), &scales->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_reject, 1, sizeof(int), &to_org);
+    err = clSetKernelArg(k, 4, sizeof(float), &casc_thr);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_reject, 2, sizeof(int), &org_w);
+    err = clSetKernelArg(k, 5, sizeof(cl_mem), &nodes->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_reject, 3, sizeof(int), &dims->w);
+    err = clSetKernelArg(k, 6, sizeof(cl_mem), &chns->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_reject, 4, sizeof(float), &casc_thr);
+    err = clSetKernelArg(k, 7, sizeof(cl_mem), &out->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_reject, 5, sizeof(cl_mem), &thrs->mem);
+    err = clSetKernelArg(k, 8, sizeof(cl_mem), &idx->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_reject, 6, sizeof(cl_mem), &hs->mem);
+    err = clSetKernelArg(k, 9, sizeof(int), &cell);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_reject, 7, sizeof(cl_mem), &fids->mem);
+    err = clSetKernelArg(k, 10, sizeof(int), &storage);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_reject, 8, sizeof(cl_mem), &chns->mem);
+    if (k == tiled) {
+        win_sz.s[0] = win->w;
+        win_sz.s[1] = win->h;
+        err = clSetKernelArg(k, 11, sizeof(cl_int2), &win_sz);
+        assert(err == CL_SUCCESS);
+    }
+    arg = k == tiled ? 13 : 11;
+    err = clSetKernelArg(k, arg++, sizeof(int), &num_early);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_reject, 9, sizeof(cl_mem), &cids->mem);
+    err = clSetKernelArg(k, arg++, sizeof(int), &coarse);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_reject, 10, sizeof(cl_mem), &out->mem);
+    err = clSetKernelArg(k, arg++, sizeof(cl_mem), &coarse_scales->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_reject, 11, sizeof(cl_mem), &idx->mem);
+    err = clSetKernelArg(k, arg++, sizeof(cl_mem), &coarse_out->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_reject, 12, sizeof(int), &out_off);
+    err = clSetKernelArg(k, arg++, sizeof(float), &coarse_thr);
     assert(err == CL_SUCCESS);
 
     err = clEnqueueNDRangeKernel(
-        gpu->queue, dc->early_reject, 2, offset, size, NULL, 0, NULL, NULL);
+        gpu->queue, k, 1, offset, size, local, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
 }
 
 static void
 early_scan(
     yapd_gpu_t* gpu, yapd_buffer_t* tmp, yapd_buffer_t* idx,
-    int len_off, int out_off, const yapd_size_t* dims, yapd_buffer_t* len)
+    int n, yapd_buffer_t* blocks)
 {
     cl_int err;
+    const int num_blocks = (n + SCAN_BLOCK - 1) / SCAN_BLOCK;
     size_t offset[] = { 0, 0, 0 };
-    size_t size[] = { dims->h, 0, 0 };
+    size_t size[] = { num_blocks*SCAN_GROUP, 0, 0 };
+    size_t local[] = { SCAN_GROUP, 0, 0 };
     yapd_gpu_detector_ctx_t* dc = &gpu->detector;
 
-    assert(idx->bytes >= (dims->w*dims->h + out_off) * sizeof(float));
-    assert(len->bytes >= (dims->h + len_off) * sizeof(int));
+    assert(idx->bytes >= n * sizeof(int));
+    assert(blocks->bytes >= num_blocks * sizeof(int));
 
     err = clSetKernelArg(dc->early_scan, 0, sizeof(cl_mem), &tmp->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_scan, 1, sizeof(int), &dims->w);
-    assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_scan, 2, sizeof(int), &out_off);
-    assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_scan, 3, sizeof(cl_mem), &idx->mem);
+    err = clSetKernelArg(dc->early_scan, 1, sizeof(int), &n);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_scan, 4, sizeof(cl_mem), &len->mem);
+    err = clSetKernelArg(dc->early_scan, 2, sizeof(cl_mem), &idx->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_scan, 5, sizeof(int), &len_off);
+    err = clSetKernelArg(dc->early_scan, 3, sizeof(cl_mem), &blocks->mem);
     assert(err == CL_SUCCESS);
 
     err = clEnqueueNDRangeKernel(
-        gpu->queue, dc->early_scan, 1, offset, size, NULL, 0, NULL, NULL);
+        gpu->queue, dc->early_scan, 1, offset, size, local, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
 }
 
 static void
 early_prefix_sum(
-    yapd_gpu_t* gpu, int num_scales,
-    yapd_buffer_t* len, yapd_buffer_t* sum, yapd_buffer_t* dsz)
+    yapd_gpu_t* gpu, int n, yapd_buffer_t* blocks, yapd_buffer_t* count,
+    int slot)
 {
     cl_int err;
+    const int num_blocks = (n + SCAN_BLOCK - 1) / SCAN_BLOCK;
     size_t offset[] = { 0, 0, 0 };
-    size_t size[] = { num_scales, 0, 0 };
+    size_t size[] = { SCAN_GROUP, 0, 0 };
     yapd_gpu_detector_ctx_t* dc = &gpu->detector;
 
-    err = clSetKernelArg(dc->early_prefix_sum, 0, sizeof(cl_mem), &len->mem);
+    err = clSetKernelArg(
+        dc->early_prefix_sum, 0, sizeof(cl_mem), &blocks->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_prefix_sum, 1, sizeof(cl_mem), &sum->mem);
+    err = clSetKernelArg(dc->early_prefix_sum, 1, sizeof(int), &num_blocks);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_prefix_sum, 2, sizeof(cl_mem), &dsz->mem);
+    err = clSetKernelArg(
+        dc->early_prefix_sum, 2, sizeof(cl_mem), &count->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(dc->early_prefix_sum, 3, sizeof(int), &slot);
     assert(err == CL_SUCCESS);
 
     err = clEnqueueNDRangeKernel(
         gpu->queue, dc->early_prefix_sum,
-        1, offset, size, NULL, 0, NULL, NULL);
+        1, offset, size, size, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
 }
 
 static void
 early_bbs(
     yapd_gpu_t* gpu, float casc_thr,
-    int bbs_off, int sum_off, int off, int num_scales,
-    const yapd_size_t* dims, yapd_buffer_t* out,
-    yapd_buffer_t* idx, yapd_buffer_t* bbs, yapd_buffer_t* sum)
+    int num_scales, const yapd_detector_scale_t* total,
+    yapd_buffer_t* scales, yapd_buffer_t* out, yapd_buffer_t* idx,
+    yapd_buffer_t* bbs, yapd_buffer_t* blocks, int cap)
 {
     cl_int err;
     size_t offset[] = { 0, 0, 0 };
-    size_t size[] = { dims->w, dims->h, 1 };
+    size_t size[] = { total->out_off, 0, 0 };
     yapd_gpu_detector_ctx_t* dc = &gpu->detector;
 
-    err = clSetKernelArg(dc->early_bbs, 0, sizeof(int), &dims->w);
+    err = clSetKernelArg(dc->early_bbs, 0, sizeof(int), &num_scales);
     assert(err == CL_SUCCESS);
     err = clSetKernelArg(dc->early_bbs, 1, sizeof(float), &casc_thr);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_bbs, 2, sizeof(int), &bbs_off);
+    err = clSetKernelArg(dc->early_bbs, 2, sizeof(cl_mem), &scales->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_bbs, 3, sizeof(int), &sum_off);
+    err = clSetKernelArg(dc->early_bbs, 3, sizeof(cl_mem), &out->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_bbs, 4, sizeof(int), &off);
+    err = clSetKernelArg(dc->early_bbs, 4, sizeof(cl_mem), &idx->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_bbs, 5, sizeof(cl_mem), &out->mem);
+    err = clSetKernelArg(dc->early_bbs, 5, sizeof(cl_mem), &bbs->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_bbs, 6, sizeof(cl_mem), &idx->mem);
+    err = clSetKernelArg(dc->early_bbs, 6, sizeof(cl_mem), &blocks->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_bbs, 7, sizeof(cl_mem), &bbs->mem);
-    assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->early_bbs, 8, sizeof(cl_mem), &sum->mem);
+    err = clSetKernelArg(dc->early_bbs, 7, sizeof(int), &cap);
     assert(err == CL_SUCCESS);
 
     err = clEnqueueNDRangeKernel(
         gpu->queue, dc->early_bbs,
-        2, offset, size, NULL, 0, NULL, NULL);
+        1, offset, size, NULL, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
 }
 
+// trees [first, last) on boxes of all scales in a single launch, each box
+// keeps its scale. Enough work-groups to fill the device pull up to `cap`
+// boxes counted by `count[slot]` from `queue`.
 static void
 predict(
-    yapd_gpu_t* gpu, yapd_buffer_t* chns, yapd_buffer_t* cids,
-    int depth, int to_org, int bbs_off, int hss_off, int org_w, float casc_thr,
-    int num_weaks, int bbs_sz, yapd_buffer_t* bbs, yapd_buffer_t* hss,
-    yapd_buffer_t* thrs, yapd_buffer_t* hs, yapd_buffer_t* fids)
+    yapd_gpu_t* gpu, cl_kernel k, yapd_buffer_t* chns,
+    int depth, int to_org, yapd_buffer_t* scales, int cell,
+    int storage, float casc_thr, int first, int last, int cap,
+    yapd_buffer_t* bbs, yapd_buffer_t* nodes, yapd_buffer_t* count,
+    int slot, yapd_buffer_t* queue)
 {
     cl_int err;
+    const int groups = YAPD_MIN(
+        cap, (int)gpu->detector.compute_units*PREDICT_RESIDENT);
     size_t offset[] = { 0, 0, 0 };
-    size_t size[] = { bbs_sz, num_weaks, 1 };
-    yapd_gpu_detector_ctx_t* dc = &gpu->detector;
+    size_t size[] = { groups*PREDICT_GROUP, 0, 0 };
+    size_t local[] = { PREDICT_GROUP, 0, 0 };
 
-    assert(bbs_sz > 0);
-    assert(bbs->bytes >= bbs_sz * sizeof(float) * 5);
+    assert(cap > 0);
+    assert(bbs->bytes >= cap * sizeof(float) * 5);
 
-    err = clSetKernelArg(dc->predict, 0, sizeof(int), &num_weaks);
+    err = clSetKernelArg(k, 0, sizeof(int), &first);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict, 1, sizeof(int), &depth);
+    err = clSetKernelArg(k, 1, sizeof(int), &last);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict, 2, sizeof(int), &to_org);
+    err = clSetKernelArg(k, 2, sizeof(int), &depth);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict, 3, sizeof(int), &org_w);
+    err = clSetKernelArg(k, 3, sizeof(int), &to_org);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict, 4, sizeof(float), &casc_thr);
+    err = clSetKernelArg(k, 4, sizeof(cl_mem), &scales->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict, 5, sizeof(int), &bbs_off);
+    err = clSetKernelArg(k, 5, sizeof(float), &casc_thr);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict, 6, sizeof(int), &hss_off);
+    err = clSetKernelArg(k, 6, sizeof(cl_mem), &nodes->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict, 7, sizeof(cl_mem), &thrs->mem);
+    err = clSetKernelArg(k, 7, sizeof(cl_mem), &chns->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict, 8, sizeof(cl_mem), &hs->mem);
+    err = clSetKernelArg(k, 8, sizeof(cl_mem), &bbs->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict, 9, sizeof(cl_mem), &fids->mem);
+    err = clSetKernelArg(k, 9, sizeof(int), &cell);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict, 10, sizeof(cl_mem), &chns->mem);
+    err = clSetKernelArg(k, 10, sizeof(int), &storage);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict, 11, sizeof(cl_mem), &cids->mem);
+    err = clSetKernelArg(k, 11, sizeof(cl_mem), &count->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict, 12, sizeof(cl_mem), &bbs->mem);
+    err = clSetKernelArg(k, 12, sizeof(int), &slot);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict, 13, sizeof(cl_mem), &hss->mem);
+    err = clSetKernelArg(k, 13, sizeof(int), &cap);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 14, sizeof(cl_mem), &queue->mem);
     assert(err == CL_SUCCESS);
 
     err = clEnqueueNDRangeKernel(
-        gpu->queue, dc->predict, 2, offset, size, NULL, 0, NULL, NULL);
+        gpu->queue, k, 1, offset, size, local, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
 }
 
+// packs boxes of `src` which survived the stage counted by `count[slot]`
+// into `dst`, the first `n` of them are scanned.
 static void
-predict_sum(
-    yapd_gpu_t* gpu, int num_weaks, int bbs_sz, float casc_thr,
-    yapd_buffer_t* hss, yapd_buffer_t* bss)
+compact(
+    yapd_gpu_t* gpu, int n, yapd_buffer_t* src, yapd_buffer_t* dst,
+    yapd_buffer_t* flags, yapd_buffer_t* idx, yapd_buffer_t* blocks,
+    yapd_buffer_t* count, int slot, int cap)
 {
     cl_int err;
     size_t offset[] = { 0, 0, 0 };
-    size_t size[] = { bbs_sz, 0, 0 };
+    size_t size[] = { n, 0, 0 };
     yapd_gpu_detector_ctx_t* dc = &gpu->detector;
 
-    err = clSetKernelArg(dc->predict_sum, 0, sizeof(int), &num_weaks);
+    assert(flags->bytes >= n * sizeof(int));
+
+    err = clSetKernelArg(dc->stage_flags, 0, sizeof(cl_mem), &src->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(dc->stage_flags, 1, sizeof(cl_mem), &count->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict_sum, 1, sizeof(float), &casc_thr);
+    err = clSetKernelArg(dc->stage_flags, 2, sizeof(int), &slot);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict_sum, 2, sizeof(cl_mem), &hss->mem);
+    err = clSetKernelArg(dc->stage_flags, 3, sizeof(int), &cap);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(dc->predict_sum, 3, sizeof(cl_mem), &bss->mem);
+    err = clSetKernelArg(dc->stage_flags, 4, sizeof(cl_mem), &flags->mem);
     assert(err == CL_SUCCESS);
+    err = clEnqueueNDRangeKernel(
+        gpu->queue, dc->stage_flags, 1, offset, size, NULL, 0, NULL, NULL);
+    assert(err == CL_SUCCESS);
+
+    early_scan(gpu, flags, idx, n, blocks);
+    early_prefix_sum(gpu, n, blocks, count, slot + 1);
 
+    err = clSetKernelArg(dc->stage_bbs, 0, sizeof(cl_mem), &src->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(dc->stage_bbs, 1, sizeof(cl_mem), &flags->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(dc->stage_bbs, 2, sizeof(cl_mem), &idx->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(dc->stage_bbs, 3, sizeof(cl_mem), &blocks->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(dc->stage_bbs, 4, sizeof(cl_mem), &dst->mem);
+    assert(err == CL_SUCCESS);
     err = clEnqueueNDRangeKernel(
-        gpu->queue, dc->predict_sum,
-        1, offset, size, NULL, 0, NULL, NULL);
+        gpu->queue, dc->stage_bbs, 1, offset, size, NULL, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
 }
 
+// converts n boxes of given scale to the original image coordinate.
+static float*
+to_image(
+    yapd_detector_t* d, yapd_pyramid_t* p,
+    int stride, int scale, float* b, int n)
+{
+    int k;
+    const float win_pad_w = (d->win_sz.w - d->org_win.w) / 2.0f;
+    const float win_pad_h = (d->win_sz.h - d->org_win.h) / 2.0f;
+    const float shift_x = win_pad_w - p->opts.pad.w;
+    const float shift_y = win_pad_h - p->opts.pad.h;
+    for (k = 0; k < n; ++k) {
+        b[0] = (b[0] * stride + shift_x) / p->scalesw[scale];
+        b[1] = (b[1] * stride + shift_y) / p->scalesh[scale];
+        b[2] = d->org_win.w / p->scales[scale];
+        b[3] = d->org_win.h / p->scales[scale];
+        b += 5;
+    }
+    return b;
+}
+
+// packs up to `cap` surviving windows then runs the remaining stages on
+// them, survivors of each stage are compacted before the next one. Nothing
+// is read back, boxes of the last stage are returned.
+static yapd_buffer_t*
+propose(
+    yapd_detector_t* d, yapd_pyramid_t* p, int stride, float casc_thr,
+    int cap)
+{
+    int k;
+    yapd_buffer_t *src = &d->bbs, *dst = &d->stage_bbs, *t;
+    const yapd_detector_scale_t* total = d->scales_host + p->num_scales;
+    // boxes are never more than windows, scan buffers are sized by them
+    const int n = YAPD_MIN(cap, total->out_off);
+    yapd_buffer_reserve(&d->bbs, cap * sizeof(float) * 5);
+    if (d->num_stages > 2) {
+        yapd_buffer_reserve(&d->stage_bbs, cap * sizeof(float) * 5);
+        yapd_buffer_reserve(&d->stage_idx, n * sizeof(int));
+        yapd_buffer_reserve(
+            &d->stage_blocks, (n + SCAN_BLOCK - 1) / SCAN_BLOCK * sizeof(int));
+    }
+    yapd_buffer_reserve(&d->queue, sizeof(int));
+    if (cap == 0) return src;
+    early_bbs(
+        d->gpu, casc_thr, p->num_scales, total, &d->scales,
+        &d->out, &d->idx, &d->bbs, &d->blocks, cap);
+    for (k = 1; k < d->num_stages; ++k) {
+        if (k > 1) {
+            compact(
+                d->gpu, n, src, dst, &d->tmp, &d->stage_idx, &d->stage_blocks,
+                &d->count, k - 2, cap);
+            t = src; src = dst; dst = t;
+        }
+        // first stage past early rejection starts over from the first tree
+        yapd_buffer_zero(&d->queue);
+        predict(
+            d->gpu, d->predict, &p->slots, d->depth,
+            stride / d->shrink, &d->scales, d->cell, d->storage, casc_thr,
+            k == 1 ? 0 : d->stages[k - 1], d->stages[k], cap,
+            src, &d->nodes, &d->count, k - 1, &d->queue);
+    }
+    return src;
+}
+
+static yapd_mat_t
+predict_cpu(
+    yapd_alloc_t a, void* aud,
+    yapd_detector_t* d, yapd_pyramid_t* p,
+    int stride, float casc_thr)
+{
+    yapd_mat_t r;
+    float *out, *bbs, *b;
+    int *lens, i, x, y, off, bbs_sz, out_bytes;
+    const int to_org = stride / d->shrink;
+
+    out_bytes = 0;
+    lens = (int*)a.alloc(aud, p->num_scales * sizeof(int), YAPD_DEFAULT_ALIGN);
+    for (i = 0; i < p->num_scales; ++i) {
+        yapd_size_t dims;
+        output_dims(&dims, d->shrink, stride, &d->win_sz, p->data_sz + i);
+        assert(dims.w > 0 && dims.h > 0);
+        out_bytes += dims.w * dims.h * sizeof(float);
+    }
+    yapd_buffer_reserve(&d->out, out_bytes);
+    out = (float*)d->out.host;
+
+    // early cascade rejection
+    off = 0; bbs_sz = 0;
+    for (i = 0; i < p->num_scales; ++i) {
+        yapd_size_t dims, coarse;
+        float* coarse_out = NULL;
+        output_dims(&dims, d->shrink, stride, &d->win_sz, p->data_sz + i);
+        if (d->coarse) {
+            // coarse grid of the scale first
+            output_dims(
+                &coarse, d->shrink, stride*d->coarse,
+                &d->win_sz, p->data_sz + i);
+            yapd_buffer_reserve(
+                &d->coarse_out, coarse.w * coarse.h * sizeof(float));
+            coarse_out = (float*)d->coarse_out.host;
+            yapd_cpu_detector_early_reject(
+                d->gpu, d, p->data[i].host, to_org*d->coarse,
+                p->data_sz[i].w, d->coarse_thr, &coarse, coarse_out,
+                NULL, 0, 0.0f);
+        }
+        yapd_cpu_detector_early_reject(
+            d->gpu, d, p->data[i].host, to_org,
+            p->data_sz[i].w, casc_thr, &dims, out + off,
+            coarse_out, d->coarse, d->coarse_thr);
+        lens[i] = 0;
+        for (y = 0; y < dims.w * dims.h; ++y) {
+            lens[i] += out[off + y] > casc_thr;
+        }
+        bbs_sz += lens[i]; off += dims.w * dims.h;
+    }
+
+    // predict the remainings
+    bbs = (float*)a.alloc(aud, bbs_sz * sizeof(float) * 5, YAPD_DEFAULT_ALIGN);
+    off = 0; b = bbs;
+    for (i = 0; i < p->num_scales; ++i) {
+        float* const bi = b;
+        yapd_size_t dims;
+        output_dims(&dims, d->shrink, stride, &d->win_sz, p->data_sz + i);
+        for (y = 0; y < dims.h; ++y) {
+            for (x = 0; x < dims.w; ++x) {
+                const float h = out[off + y*dims.w + x];
+                if (h <= casc_thr) continue;
+                b[0] = (float)x; b[1] = (float)y; b[4] = h; b += 5;
+            }
+        }
+        yapd_cpu_detector_predict(
+            d->gpu, d, p->data[i].host,
+            to_org, p->data_sz[i].w, lens[i], bi);
+        to_image(d, p, stride, i, bi, lens[i]);
+        off += dims.w * dims.h;
+    }
+
+    r = yapd_mat_take(a, aud, (uint8_t*)bbs, 5, bbs_sz, YAPD_32F);
+    yapd_nms(a, aud, &r, 30, 0.65f, TRUE);
+    a.dealloc(aud, lens);
+    return r;
+}
+
 void
 yapd_gpu_setup_detector(
     yapd_gpu_t* gpu)
 {
     cl_int err;
+    size_t wg_sz;
     yapd_gpu_detector_ctx_t* d = &gpu->detector;
-    d->program = yapd_gpu_load_program(gpu, detector_cl);
+    d->program = yapd_gpu_load_program(gpu, detector_cl, NULL);
     d->early_reject = clCreateKernel(
         d->program, "detector_early_reject", &err);
     assert(err == CL_SUCCESS);
+    d->early_reject_tiled = clCreateKernel(
+        d->program, "detector_early_reject_tiled", &err);
+    assert(err == CL_SUCCESS);
     d->early_scan = clCreateKernel(
         d->program, "detector_early_scan", &err);
     assert(err == CL_SUCCESS);
@@ -332,8 +594,24 @@ yapd_gpu_setup_detector(
     d->predict = clCreateKernel(
         d->program, "detector_predict", &err);
     assert(err == CL_SUCCESS);
-    d->predict_sum = clCreateKernel(
-        d->program, "detector_predict_sum", &err);
+    d->stage_flags = clCreateKernel(
+        d->program, "detector_stage_flags", &err);
+    assert(err == CL_SUCCESS);
+    d->stage_bbs = clCreateKernel(
+        d->program, "detector_stage_bbs", &err);
+    assert(err == CL_SUCCESS);
+    err = clGetDeviceInfo(
+        gpu->dev_ids[0], CL_DEVICE_LOCAL_MEM_SIZE,
+        sizeof(cl_ulong), &d->local_mem, NULL);
+    assert(err == CL_SUCCESS);
+    err = clGetKernelWorkGroupInfo(
+        d->early_reject_tiled, gpu->dev_ids[0], CL_KERNEL_WORK_GROUP_SIZE,
+        sizeof(size_t), &wg_sz, NULL);
+    assert(err == CL_SUCCESS);
+    d->tiled = wg_sz >= WIN_TILE_W*WIN_TILE_H;
+    err = clGetDeviceInfo(
+        gpu->dev_ids[0], CL_DEVICE_MAX_COMPUTE_UNITS,
+        sizeof(cl_uint), &d->compute_units, NULL);
     assert(err == CL_SUCCESS);
 }
 
@@ -341,14 +619,63 @@ void
 yapd_gpu_release_detector(
     yapd_gpu_t* gpu)
 {
+    int i;
     yapd_gpu_detector_ctx_t* d = &gpu->detector;
     clReleaseKernel(d->early_reject);
+    clReleaseKernel(d->early_reject_tiled);
     clReleaseKernel(d->early_scan);
     clReleaseKernel(d->early_prefix_sum);
     clReleaseKernel(d->early_bbs);
     clReleaseKernel(d->predict);
-    clReleaseKernel(d->predict_sum);
+    clReleaseKernel(d->stage_flags);
+    clReleaseKernel(d->stage_bbs);
     clReleaseProgram(d->program);
+    for (i = 0; i < d->num_variants; ++i) {
+        clReleaseKernel(d->variants[i].early_reject);
+        clReleaseKernel(d->variants[i].early_reject_tiled);
+        clReleaseKernel(d->variants[i].predict);
+        clReleaseProgram(d->variants[i].program);
+    }
+    d->num_variants = 0;
+}
+
+// picks kernels specialized for depth of the classifier.
+static void
+specialize(
+    yapd_detector_t* d)
+{
+    int i;
+    cl_int err;
+    char options[32];
+    yapd_gpu_detector_variant_t* v = NULL;
+    yapd_gpu_detector_ctx_t* c = &d->gpu->detector;
+    for (i = 0; i < c->num_variants && !v; ++i) {
+        if (c->variants[i].depth == d->depth) v = c->variants + i;
+    }
+    if (!v && c->num_variants == YAPD_GPU_MAX_VARIANTS) {
+        d->early_reject = c->early_reject;
+        d->early_reject_tiled = c->early_reject_tiled;
+        d->predict = c->predict;
+        return;
+    }
+    if (!v) {
+        v = c->variants + c->num_variants++;
+        v->depth = d->depth;
+        snprintf(options, sizeof(options), "-DTREE_DEPTH=%d", d->depth);
+        v->program = yapd_gpu_load_program(d->gpu, detector_cl, options);
+        v->early_reject = clCreateKernel(
+            v->program, "detector_early_reject", &err);
+        assert(err == CL_SUCCESS);
+        v->early_reject_tiled = clCreateKernel(
+            v->program, "detector_early_reject_tiled", &err);
+        assert(err == CL_SUCCESS);
+        v->predict = clCreateKernel(
+            v->program, "detector_predict", &err);
+        assert(err == CL_SUCCESS);
+    }
+    d->early_reject = v->early_reject;
+    d->early_reject_tiled = v->early_reject_tiled;
+    d->predict = v->predict;
 }
 
 yapd_detector_t
@@ -364,31 +691,44 @@ yapd_detector_new(
     d.dirty = TRUE;
     d.num_weaks = 0;
     d.depth = 0;
+    d.num_stages = 0;
+    d.early_reject = NULL;
+    d.early_reject_tiled = NULL;
+    d.predict = NULL;
     d.win_sz.w = 0;
     d.win_sz.h = 0;
     d.org_win.w = 0;
     d.org_win.h = 0;
     d.shrink = 0;
+    d.cell = 0;
+    d.storage = YAPD_FEATURE_FLOAT;
 
     d.thrs_host = yapd_mat_new(a, aud);
     d.fids_host = yapd_mat_new(a, aud);
     d.hs_host = yapd_mat_new(a, aud);
-    d.thrs = yapd_buffer_readonly(gpu, 0);
-    d.fids = yapd_buffer_readonly(gpu, 0);
-    d.hs = yapd_buffer_readonly(gpu, 0);
+    d.nodes_host = NULL;
+    d.nodes = yapd_buffer_readonly(gpu, 0);
 
-    d.num_scales = 0;
-    d.sizes = NULL;
-    d.cids_host = NULL;
-    d.cids = NULL;
 
-    d.dsz = yapd_buffer_create(gpu, 0);
+    d.num_scales = 0;
+    d.scales_host = NULL;
+    d.scales = yapd_buffer_readonly(gpu, 0);
     d.out = yapd_buffer_create(gpu, 0);
     d.idx = yapd_buffer_create(gpu, 0);
-    d.len = yapd_buffer_create(gpu, 0);
-    d.sum = yapd_buffer_create(gpu, 0);
+    d.blocks = yapd_buffer_create(gpu, 0);
+    d.count = yapd_buffer_create(gpu, 0);
+    d.queue = yapd_buffer_create(gpu, 0);
+    d.capacity = 0;
+    d.coarse = 0;
+    d.coarse_thr = 0.0f;
+    d.num_coarse_scales = 0;
+    d.coarse_scales_host = NULL;
+    d.coarse_scales = yapd_buffer_readonly(gpu, 0);
+    d.coarse_out = yapd_buffer_create(gpu, 0);
     d.bbs = yapd_buffer_create(gpu, 0);
-    d.hss = yapd_buffer_create(gpu, 0);
+    d.stage_bbs = yapd_buffer_create(gpu, 0);
+    d.stage_idx = yapd_buffer_create(gpu, 0);
+    d.stage_blocks = yapd_buffer_create(gpu, 0);
     d.tmp = yapd_buffer_create(gpu, 0);
 
     return d;
@@ -398,25 +738,51 @@ void
 yapd_detector_release(
     yapd_detector_t* d)
 {
-    release_cids(d);
-
-    yapd_buffer_release(&d->dsz);
+    d->a.dealloc(d->aud, d->scales_host);
+    d->scales_host = NULL;
+    d->num_scales = 0;
+    yapd_buffer_release(&d->scales);
     yapd_buffer_release(&d->out);
     yapd_buffer_release(&d->idx);
-    yapd_buffer_release(&d->len);
-    yapd_buffer_release(&d->sum);
+    yapd_buffer_release(&d->blocks);
+    yapd_buffer_release(&d->count);
+    yapd_buffer_release(&d->queue);
+    d->a.dealloc(d->aud, d->coarse_scales_host);
+    d->coarse_scales_host = NULL;
+    d->num_coarse_scales = 0;
+    yapd_buffer_release(&d->coarse_scales);
+    yapd_buffer_release(&d->coarse_out);
     yapd_buffer_release(&d->bbs);
-    yapd_buffer_release(&d->hss);
+    yapd_buffer_release(&d->stage_bbs);
+    yapd_buffer_release(&d->stage_idx);
+    yapd_buffer_release(&d->stage_blocks);
     yapd_buffer_release(&d->tmp);
 
     d->win_sz.w = 0;
     d->win_sz.h = 0;
-    yapd_buffer_release(&d->thrs);
-    yapd_buffer_release(&d->fids);
-    yapd_buffer_release(&d->hs);
+    yapd_buffer_release(&d->nodes);
     yapd_mat_release(&d->thrs_host);
     yapd_mat_release(&d->fids_host);
     yapd_mat_release(&d->hs_host);
+    d->a.dealloc(d->aud, d->nodes_host);
+    d->nodes_host = NULL;
+}
+
+void
+yapd_detector_capacity(
+    yapd_detector_t* d, int capacity)
+{
+    assert(capacity >= 0);
+    d->capacity = capacity;
+}
+
+void
+yapd_detector_coarse(
+    yapd_detector_t* d, int coarse, float thr)
+{
+    assert(coarse >= 0);
+    d->coarse = coarse > 1 ? coarse : 0;
+    d->coarse_thr = thr;
 }
 
 void
@@ -424,8 +790,10 @@ yapd_detector_classifier(
     yapd_detector_t* d, int copy,
     int num_weaks, int depth, int shrink,
     const yapd_size_t* win_sz, const yapd_size_t* org_win,
-    yapd_mat_t* thrs, yapd_mat_t* fids, yapd_mat_t* hs)
+    yapd_mat_t* thrs, yapd_mat_t* fids, yapd_mat_t* hs,
+    const int* stages, int num_stages)
 {
+    int i;
     assert(num_weaks > 0);
     assert(depth > 0 && depth < 4);
     assert(shrink > 0);
@@ -437,12 +805,30 @@ yapd_detector_classifier(
     assert(thrs->size.h == num_weaks && thrs->size.w == 8);
     assert(fids->size.h == num_weaks && fids->size.w == 8);
     assert(hs->size.h == num_weaks && hs->size.w == 8);
+    assert(stages || num_stages == 0);
+    assert(num_stages >= 0 && num_stages < YAPD_DETECTOR_MAX_STAGES);
 
+    for (i = 0; i < num_stages; ++i) {
+        assert(stages[i] > (i ? stages[i - 1] : 0));
+        assert(stages[i] < num_weaks);
+        d->stages[i] = stages[i];
+    }
+    if (num_stages == 0) {
+        // early rejection then the rest
+        d->stages[0] = YAPD_MIN(YAPD_DETECTOR_EARLY_WEAKS, num_weaks);
+        num_stages = 1;
+    }
+    assert(d->stages[0] <= YAPD_DETECTOR_EARLY_WEAKS);
+    d->stages[num_stages] = num_weaks;
+    d->num_stages = num_stages + 1;
     d->num_weaks = num_weaks;
     d->shrink = shrink;
     d->depth = depth;
     d->win_sz = *win_sz;
     d->org_win = *org_win;
+    if (d->gpu->backend == YAPD_BACKEND_OPENCL) {
+        specialize(d);
+    }
 
     yapd_mat_release(&d->thrs_host);
     yapd_mat_release(&d->fids_host);
@@ -467,19 +853,6 @@ yapd_detector_classifier(
             hs->data, hs->size.w, hs->size.h, hs->type);
     }
 
-    yapd_buffer_reserve(
-        &d->thrs, yapd_mat_bytes(&d->thrs_host));
-    yapd_buffer_upload(
-        &d->thrs, d->thrs_host.data, yapd_mat_bytes(&d->thrs_host));
-    yapd_buffer_reserve(
-        &d->fids, yapd_mat_bytes(&d->fids_host));
-    yapd_buffer_upload(
-        &d->fids, d->fids_host.data, yapd_mat_bytes(&d->fids_host));
-    yapd_buffer_reserve(
-        &d->hs, yapd_mat_bytes(&d->hs_host));
-    yapd_buffer_upload(
-        &d->hs, d->hs_host.data, yapd_mat_bytes(&d->hs_host));
-
     d->dirty = TRUE;
 }
 
@@ -490,123 +863,100 @@ yapd_detector_predict(
     int stride, float casc_thr)
 {
     yapd_mat_t r;
+    yapd_size_t win;
     float *bbs, *b;
-    int *dsz, *len, len_off, off, bbs_off, hss_off, bbs_sz;
-    int i, j, k, dsz_bytes, out_bytes, idx_bytes, lens, bbs_bytes, hss_bytes;
-    const float win_pad_w = (d->win_sz.w - d->org_win.w) / 2.0f;
-    const float win_pad_h = (d->win_sz.h - d->org_win.h) / 2.0f;
-    const float shift_x = win_pad_w - p->opts.pad.w;
-    const float shift_y = win_pad_h - p->opts.pad.h;
+    int i, n, cap, bbs_sz, out_bytes, idx_bytes;
+    int counts[YAPD_DETECTOR_MAX_STAGES];
+    yapd_buffer_t* last;
+    const yapd_detector_scale_t *total, *coarse;
     assert(d->num_weaks > 0);
 
-    if (d->dirty) {
+    if (d->dirty || d->cell != p->cell || d->storage != p->opts.storage) {
+        // nodes follow feature layout of the pyramid
         d->dirty = FALSE;
-        alloc(d, p->num_scales);
+        d->cell = p->cell;
+        d->storage = p->opts.storage;
+        pack_nodes(d, p);
     }
-    reserve(d, p->data_sz, p->num_scales);
 
-    // prepare output buffer
-    out_bytes = 0, idx_bytes = 0; lens = 0;
-    dsz_bytes = p->num_scales * sizeof(int) * 2;
-    dsz = (int*)a.alloc(aud, dsz_bytes, YAPD_DEFAULT_ALIGN);
-    for (i = 0; i < p->num_scales; ++i) {
-        yapd_size_t dims;
-        output_dims(&dims, d->shrink, stride, &d->win_sz, p->data_sz + i);
-        assert(dims.w > 0 && dims.h > 0);
-        out_bytes += dims.w * dims.h * sizeof(float);
-        idx_bytes += dims.w * dims.h * sizeof(int);
-        lens += dims.h;
-        if (i == 0) {
-            dsz[0] = dims.h;
-            dsz[1] = 0;
-        } else {
-            dsz[i * 2] = dims.h;
-            dsz[i * 2 + 1] = dsz[(i - 1) * 2] + dsz[(i - 1) * 2 + 1];
-        }
+    if (d->gpu->backend == YAPD_BACKEND_CPU) {
+        return predict_cpu(a, aud, d, p, stride, casc_thr);
     }
-    yapd_buffer_reserve(&d->dsz, dsz_bytes);
-    yapd_buffer_upload(&d->dsz, (uint8_t*)dsz, dsz_bytes);
+
+    // windows and boxes of all scales are flattened
+    describe_scales(
+        d, p, stride, &d->num_scales, &d->scales_host, &d->scales);
+    total = d->scales_host + p->num_scales;
+    n = total->out_off;
+    out_bytes = n * sizeof(float);
+    idx_bytes = n * sizeof(int);
     yapd_buffer_reserve(&d->out, out_bytes);
     yapd_buffer_reserve(&d->idx, idx_bytes);
-    yapd_buffer_reserve(&d->len, lens * sizeof(int));
-    yapd_buffer_reserve(&d->sum, lens * sizeof(int));
+    yapd_buffer_reserve(
+        &d->blocks, (n + SCAN_BLOCK - 1) / SCAN_BLOCK * sizeof(int));
+    yapd_buffer_reserve(&d->count, sizeof(counts));
     yapd_buffer_reserve(&d->tmp, idx_bytes);
 
-    // early cascade rejection
-    len_off = 0; off = 0;
-    len = (int*)a.alloc(aud, lens * sizeof(int), YAPD_DEFAULT_ALIGN);
-    for (i = 0; i < p->num_scales; ++i) {
-        yapd_size_t dims;
-        output_dims(&dims, d->shrink, stride, &d->win_sz, p->data_sz + i);
+    // early cascade rejection, survivors are compacted on the device
+    win.w = d->win_sz.w / d->shrink;
+    win.h = d->win_sz.h / d->shrink;
+    if (d->coarse) {
+        // coarse grid first, its flags are scratch in idx
+        describe_scales(
+            d, p, stride*d->coarse, &d->num_coarse_scales,
+            &d->coarse_scales_host, &d->coarse_scales);
+        coarse = d->coarse_scales_host + p->num_scales;
+        yapd_buffer_reserve(&d->coarse_out, coarse->out_off * sizeof(float));
         early_reject(
-            d->gpu, p->data + i, d->cids + i, d->depth,
-            stride/d->shrink, off, p->data_sz[i].w, casc_thr,
-            &dims, &d->out, &d->tmp, &d->thrs, &d->hs, &d->fids);
-        early_scan(
-            d->gpu, &d->tmp, &d->idx, len_off, off, &dims, &d->len);
-        len_off += dims.h; off += dims.w * dims.h;
+            d->gpu, d->early_reject, d->early_reject_tiled, &p->slots,
+            d->depth, stride/d->shrink*d->coarse, p->num_scales,
+            d->coarse_scales_host, &win, d->cell, d->storage,
+            d->coarse_thr, &d->coarse_scales, &d->coarse_out, &d->idx,
+            &d->nodes, d->stages[0], 0, &d->coarse_scales, &d->coarse_out,
+            d->coarse_thr);
     }
-    early_prefix_sum(d->gpu, p->num_scales, &d->len, &d->sum, &d->dsz);
-    yapd_buffer_download_sync(&d->len, (uint8_t*)len, lens * sizeof(int));
-    for (i = 0, j = 0, bbs_sz = 0; i < p->num_scales; ++i) {
-        const int h = dsz[i * 2];
-        int* const l = len + j; j += h;
-        for (k = 1; k < h; ++k) {
-            // inclusive prefix sum
-            l[k] = l[k] + l[k - 1];
-        }
-        bbs_sz += l[k - 1];
+    early_reject(
+        d->gpu, d->early_reject, d->early_reject_tiled, &p->slots,
+        d->depth, stride/d->shrink, p->num_scales, d->scales_host, &win,
+        d->cell, d->storage, casc_thr,
+        &d->scales, &d->out, &d->tmp, &d->nodes, d->stages[0],
+        d->coarse, &d->coarse_scales, &d->coarse_out, d->coarse_thr);
+    early_scan(d->gpu, &d->tmp, &d->idx, n, &d->blocks);
+    early_prefix_sum(d->gpu, n, &d->blocks, &d->count, 0);
+    if (d->capacity > 0) {
+        // proposals are counted on the device only
+        cap = d->capacity;
+    } else {
+        yapd_buffer_download_sync(&d->count, (uint8_t*)&cap, sizeof(int));
     }
-    bbs_bytes = bbs_sz * sizeof(float) * 5;
-    yapd_buffer_reserve(&d->bbs, bbs_bytes);
-    hss_bytes = bbs_sz * sizeof(float) * d->num_weaks;
-    yapd_buffer_reserve(&d->hss, hss_bytes);
-    len_off = 0; off = 0; j = 0;  bbs_off = 0;
-    for (i = 0; i < p->num_scales; ++i) {
-        yapd_size_t dims;
-        output_dims(&dims, d->shrink, stride, &d->win_sz, p->data_sz + i);
-        early_bbs(
-            d->gpu, casc_thr, bbs_off, len_off, off,
-            p->num_scales, &dims, &d->out, &d->idx, &d->bbs, &d->sum);
-        j += dsz[i * 2]; bbs_off += len[j - 1] * 5;
-        len_off += dims.h; off += dims.w * dims.h;
+    last = propose(d, p, stride, casc_thr, cap);
+
+    // counts of all stages and boxes are read back together
+    bbs = (float*)a.alloc(aud, cap * sizeof(float) * 5, YAPD_DEFAULT_ALIGN);
+    yapd_buffer_download(
+        &d->count, (uint8_t*)counts, (d->num_stages - 1) * sizeof(int));
+    yapd_buffer_download(last, (uint8_t*)bbs, cap * sizeof(float) * 5);
+    yapd_gpu_sync(d->gpu);
+    if (counts[0] > cap) {
+        // overflow, capacity grows and proposals of the frame are redone
+        d->capacity = cap = YAPD_MAX(counts[0], 2*cap);
+        last = propose(d, p, stride, casc_thr, cap);
+        a.dealloc(aud, bbs);
+        bbs = (float*)a.alloc(
+            aud, cap * sizeof(float) * 5, YAPD_DEFAULT_ALIGN);
+        yapd_buffer_download(
+            &d->count, (uint8_t*)counts, (d->num_stages - 1) * sizeof(int));
+        yapd_buffer_download(last, (uint8_t*)bbs, cap * sizeof(float) * 5);
+        yapd_gpu_sync(d->gpu);
     }
+    // survivors of the stage before the last one, none ran without boxes
+    bbs_sz = cap == 0 ? 0 : counts[d->num_stages - 2];
 
-    // predict the remainings
-#if 1
-    j = 0; bbs_off = 0; hss_off = 0;
-    for (i = 0; i < p->num_scales; ++i) {
-        j += dsz[i * 2];
-        if (len[j - 1] == 0) continue;
-        predict(
-            d->gpu, p->data + i, d->cids + i, d->depth,
-            stride / d->shrink, bbs_off, hss_off, p->data_sz[i].w,
-            casc_thr, d->num_weaks, len[j - 1], &d->bbs, &d->hss,
-            &d->thrs, &d->hs, &d->fids);
-        bbs_off += len[j - 1] * 5;
-        hss_off += len[j - 1] * d->num_weaks;
-    }
-    predict_sum(d->gpu, d->num_weaks, bbs_sz, casc_thr, &d->hss, &d->bbs);
-
-    // convert to bounding boxes
-    bbs = (float*)a.alloc(aud, bbs_bytes, YAPD_DEFAULT_ALIGN);
-    yapd_buffer_download_sync(&d->bbs, (uint8_t*)bbs, bbs_bytes);
-    for (i = 0, j = 0, b = bbs; i < p->num_scales; ++i) {
-        j += dsz[i * 2];
-        for (k = 0; k < len[j - 1]; ++k) {
-            b[0] = (b[0] * stride + shift_x) / p->scalesw[i];
-            b[1] = (b[1] * stride + shift_y) / p->scalesh[i];
-            b[2] = d->org_win.w / p->scales[i];
-            b[3] = d->org_win.h / p->scales[i];
-            b += 5;
-        }
+    // convert to bounding boxes, each keeps its scale
+    for (i = 0, b = bbs; i < bbs_sz; ++i) {
+        b = to_image(d, p, stride, (int)b[2], b, 1);
     }
     r = yapd_mat_take(a, aud, (uint8_t*)bbs, 5, bbs_sz, YAPD_32F);
     yapd_nms(a, aud, &r, 30, 0.65f, TRUE);
-#else
-    r = yapd_mat_new(a, aud);
-#endif
-    a.dealloc(aud, dsz);
-    a.dealloc(aud, len);
     return r;
 }
@@ -1,11 +1,20 @@
 /* Copyright (c) 2018 Giang "Yakiro" Nguyen. All rights reserved. */
 #include <yapd/gpu.h>
 
+#include <cpu/cpu.h>
+
 // TODO: build log
 #include <stdio.h>
 #include <malloc.h>
+#include <string.h>
+#ifdef YAPD_WINDOWS
+#define getpid() ((int)GetCurrentProcessId())
+#else
+#include <unistd.h>
+#endif
 
-#define YAPD_DEVICE_TYPE CL_DEVICE_TYPE_GPU
+enum { MAX_PLATFORMS = 16 };
+enum { MAX_DEVICES = 64 };
 
 extern void
 yapd_gpu_setup_color(
@@ -49,59 +58,382 @@ extern void
 yapd_gpu_release_detector(
     yapd_gpu_t* gpu);
 
+static int
+get_platforms(
+    cl_platform_id* ids)
+{
+    cl_uint count = 0;
+    const cl_int err = clGetPlatformIDs(MAX_PLATFORMS, ids, &count);
+    // CL_PLATFORM_NOT_FOUND_KHR if ICD loader has no platform
+    return err == CL_SUCCESS ? YAPD_MIN((int)count, MAX_PLATFORMS) : 0;
+}
+
+static int
+get_devices(
+    cl_platform_id platform, cl_device_type type, cl_device_id* ids)
+{
+    cl_uint count = 0;
+    const cl_int err = clGetDeviceIDs(
+        platform, type, MAX_DEVICES, ids, &count);
+    // CL_DEVICE_NOT_FOUND if platform has no device of this type
+    return err == CL_SUCCESS ? YAPD_MIN((int)count, MAX_DEVICES) : 0;
+}
+
+// copies a string param, truncated to fit `n` bytes.
 static void
-create(yapd_gpu_t* gpu)
+get_string(
+    cl_platform_id platform, cl_device_id dev,
+    cl_uint param, char* dst, int n)
 {
     cl_int err;
-    cl_uint count = 0;
-    cl_platform_id platform_ids[1];
-    cl_context_properties ctx_props[4];
-    err = clGetPlatformIDs(0, NULL, &count);
+    size_t len = 0;
+    char* s;
+    err = platform ?
+        clGetPlatformInfo(platform, param, 0, NULL, &len) :
+        clGetDeviceInfo(dev, param, 0, NULL, &len);
+    assert(err == CL_SUCCESS);
+    s = (char*)malloc(len + 1);
+    err = platform ?
+        clGetPlatformInfo(platform, param, len, s, NULL) :
+        clGetDeviceInfo(dev, param, len, s, NULL);
+    assert(err == CL_SUCCESS);
+    s[len] = 0;
+    strncpy(dst, s, n - 1);
+    dst[n - 1] = 0;
+    free(s);
+}
+
+static void
+get_info(
+    cl_platform_id platform, cl_device_id dev,
+    int platform_idx, int idx, yapd_gpu_device_info_t* info)
+{
+    cl_int err;
+    cl_uint u;
+    cl_ulong ul;
+    size_t sz;
+    memset(info, 0, sizeof(yapd_gpu_device_info_t));
+    info->platform = platform_idx;
+    info->index = idx;
+    get_string(platform, NULL, CL_PLATFORM_NAME,
+        info->platform_name, sizeof(info->platform_name));
+    get_string(NULL, dev, CL_DEVICE_NAME,
+        info->name, sizeof(info->name));
+    get_string(NULL, dev, CL_DEVICE_VENDOR,
+        info->vendor, sizeof(info->vendor));
+    get_string(NULL, dev, CL_DEVICE_VERSION,
+        info->version, sizeof(info->version));
+    get_string(NULL, dev, CL_DEVICE_EXTENSIONS,
+        info->extensions, sizeof(info->extensions));
+    err = clGetDeviceInfo(
+        dev, CL_DEVICE_TYPE, sizeof(cl_device_type), &info->type, NULL);
     assert(err == CL_SUCCESS);
-    assert(count > 0);
-    err = clGetPlatformIDs(1, platform_ids, NULL);
+    err = clGetDeviceInfo(
+        dev, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(u), &u, NULL);
     assert(err == CL_SUCCESS);
-    err = clGetDeviceIDs(
-        platform_ids[0], YAPD_DEVICE_TYPE, 0, NULL, &count);
+    info->compute_units = (int)u;
+    err = clGetDeviceInfo(
+        dev, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(u), &u, NULL);
     assert(err == CL_SUCCESS);
-    assert(count > 0);
-    err = clGetDeviceIDs(
-        platform_ids[0], YAPD_DEVICE_TYPE, 1, gpu->dev_ids, NULL);
+    info->max_clock_mhz = (int)u;
+    err = clGetDeviceInfo(
+        dev, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(sz), &sz, NULL);
     assert(err == CL_SUCCESS);
+    info->max_work_group_size = (int)sz;
+    err = clGetDeviceInfo(
+        dev, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(ul), &ul, NULL);
+    assert(err == CL_SUCCESS);
+    info->global_mem = ul;
+    err = clGetDeviceInfo(
+        dev, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(ul), &ul, NULL);
+    assert(err == CL_SUCCESS);
+    info->local_mem = ul;
+}
+
+static int
+matches(
+    cl_device_id dev, const yapd_gpu_opts_t* opts)
+{
+    char s[YAPD_GPU_INFO_NAME];
+    if (opts->device.vendor) {
+        get_string(NULL, dev, CL_DEVICE_VENDOR, s, sizeof(s));
+        if (!strstr(s, opts->device.vendor)) return FALSE;
+    }
+    if (opts->device.name) {
+        get_string(NULL, dev, CL_DEVICE_NAME, s, sizeof(s));
+        if (!strstr(s, opts->device.name)) return FALSE;
+    }
+    return TRUE;
+}
+
+// returns FALSE if there is no matched device, asserts if it is required.
+static int
+create(
+    yapd_gpu_t* gpu, const yapd_gpu_opts_t* opts, int required)
+{
+    cl_int err;
+    int i, j, num_platforms, num_devices, matched = 0;
+    cl_platform_id platform_ids[MAX_PLATFORMS];
+    cl_platform_id platform = NULL;
+    cl_device_id dev_ids[MAX_DEVICES];
+    cl_context_properties ctx_props[4];
+    assert(opts->device.index >= 0);
+    num_platforms = get_platforms(platform_ids);
+    for (i = 0; i < num_platforms && !platform; ++i) {
+        if (opts->device.platform >= 0 && opts->device.platform != i) {
+            continue;
+        }
+        num_devices = get_devices(
+            platform_ids[i], opts->device.type, dev_ids);
+        for (j = 0; j < num_devices; ++j) {
+            if (!matches(dev_ids[j], opts)) continue;
+            if (matched++ == opts->device.index) {
+                platform = platform_ids[i];
+                gpu->dev_ids[0] = dev_ids[j];
+                break;
+            }
+        }
+    }
+    if (!required && !platform) return FALSE;
+    assert(platform && "no matched OpenCL device");
     ctx_props[0] = CL_CONTEXT_PLATFORM;
-    ctx_props[1] = (cl_context_properties)platform_ids[0];
+    ctx_props[1] = (cl_context_properties)platform;
     ctx_props[2] = 0;
     ctx_props[3] = 0;
     gpu->ctx = clCreateContext(ctx_props, 1, gpu->dev_ids, NULL, NULL, &err);
     assert(err == CL_SUCCESS);
     gpu->queue = clCreateCommandQueue(gpu->ctx, gpu->dev_ids[0], 0, &err);
     assert(err == CL_SUCCESS);
+    return TRUE;
+}
+
+static const yapd_gpu_opts_t default_opts = {
+    .backend = YAPD_BACKEND_AUTO,
+    .num_threads = 0,
+    .device = {
+        .type = CL_DEVICE_TYPE_GPU,
+        .platform = -1,
+        .vendor = NULL,
+        .name = NULL,
+        .index = 0
+    },
+    .cache_dir = NULL,
+    .tri_sum_radius = 0
+};
+
+const yapd_gpu_opts_t*
+yapd_gpu_default_opts()
+{
+    return &default_opts;
+}
+
+int
+yapd_gpu_query_devices(
+    yapd_gpu_device_info_t* infos, int max_infos)
+{
+    int i, j, num_platforms, num_devices, count = 0;
+    cl_platform_id platform_ids[MAX_PLATFORMS];
+    cl_device_id dev_ids[MAX_DEVICES];
+    num_platforms = get_platforms(platform_ids);
+    for (i = 0; i < num_platforms; ++i) {
+        num_devices = get_devices(
+            platform_ids[i], CL_DEVICE_TYPE_ALL, dev_ids);
+        for (j = 0; j < num_devices; ++j, ++count) {
+            if (count >= max_infos) continue;
+            get_info(platform_ids[i], dev_ids[j], i, count, infos + count);
+        }
+    }
+    return count;
+}
+
+int
+yapd_gpu_device_info(
+    yapd_gpu_t* gpu, yapd_gpu_device_info_t* info)
+{
+    int i, j, num_platforms, num_devices, count = 0;
+    cl_platform_id platform_ids[MAX_PLATFORMS];
+    cl_device_id dev_ids[MAX_DEVICES];
+    if (gpu->backend == YAPD_BACKEND_CPU) return FALSE;
+    num_platforms = get_platforms(platform_ids);
+    for (i = 0; i < num_platforms; ++i) {
+        num_devices = get_devices(
+            platform_ids[i], CL_DEVICE_TYPE_ALL, dev_ids);
+        for (j = 0; j < num_devices; ++j, ++count) {
+            if (dev_ids[j] != gpu->dev_ids[0]) continue;
+            get_info(platform_ids[i], dev_ids[j], i, count, info);
+            return TRUE;
+        }
+    }
+    assert(!"device not found");
+    return FALSE;
 }
 
 yapd_gpu_t
-yapd_gpu_new()
+yapd_gpu_new(
+    const yapd_gpu_opts_t* opts)
 {
     yapd_gpu_t gpu;
-    create(&gpu);
-    yapd_gpu_setup_color(&gpu);
-    yapd_gpu_setup_resample(&gpu);
-    yapd_gpu_setup_convolution(&gpu);
-    yapd_gpu_setup_gradient(&gpu);
-    yapd_gpu_setup_pyramid(&gpu);
-    yapd_gpu_setup_detector(&gpu);
+    memset(&gpu, 0, sizeof(yapd_gpu_t));
+    if (!opts) opts = &default_opts;
+    assert(opts->tri_sum_radius >= 0);
+    gpu.backend = opts->backend;
+    gpu.convolution.sum_radius = opts->tri_sum_radius;
+    if (gpu.backend != YAPD_BACKEND_CPU) {
+        const int required = gpu.backend == YAPD_BACKEND_OPENCL;
+        gpu.backend = create(&gpu, opts, required) ?
+            YAPD_BACKEND_OPENCL : YAPD_BACKEND_CPU;
+    }
+    if (gpu.backend == YAPD_BACKEND_CPU) {
+        yapd_cpu_setup(&gpu, opts->num_threads);
+        return gpu;
+    }
+    if (opts->cache_dir) {
+        assert(strlen(opts->cache_dir) + 32 < YAPD_GPU_CACHE_PATH);
+        strcpy(gpu.cache_dir, opts->cache_dir);
+    }
+    // OpenCL API is thread-safe, each setup touches its own context only,
+    // so the programs are built in parallel on cache miss.
+    #pragma omp parallel sections
+    {
+        #pragma omp section
+        yapd_gpu_setup_color(&gpu);
+        #pragma omp section
+        yapd_gpu_setup_resample(&gpu);
+        #pragma omp section
+        yapd_gpu_setup_convolution(&gpu);
+        #pragma omp section
+        yapd_gpu_setup_gradient(&gpu);
+        #pragma omp section
+        yapd_gpu_setup_pyramid(&gpu);
+        #pragma omp section
+        yapd_gpu_setup_detector(&gpu);
+    }
     return gpu;
 }
 
+static uint64_t
+fnv1a(
+    uint64_t h, const char* s)
+{
+    // hashes the terminator as well, as a separator
+    do {
+        h ^= (uint8_t)*s;
+        h *= 0x100000001b3ull;
+    } while (*s++);
+    return h;
+}
+
+// cache key is hash of the device, driver version and source.
+static void
+cache_path(
+    yapd_gpu_t* gpu, const char* source, const char* options, char* path)
+{
+    int i;
+    char s[YAPD_GPU_INFO_NAME];
+    uint64_t h = 0xcbf29ce484222325ull;
+    static const cl_uint params[] = {
+        CL_DEVICE_NAME, CL_DEVICE_VENDOR, CL_DEVICE_VERSION, CL_DRIVER_VERSION
+    };
+    for (i = 0; i < (int)(sizeof(params) / sizeof(params[0])); ++i) {
+        get_string(NULL, gpu->dev_ids[0], params[i], s, sizeof(s));
+        h = fnv1a(h, s);
+    }
+    h = fnv1a(h, options ? options : "");
+    h = fnv1a(h, source);
+    snprintf(
+        path, YAPD_GPU_CACHE_PATH, "%s/yapd-%016llx.bin",
+        gpu->cache_dir, (unsigned long long)h);
+}
+
+// returns NULL if not cached, or the cached binary is rejected.
+static cl_program
+load_binary(
+    yapd_gpu_t* gpu, const char* path, const char* options)
+{
+    cl_int err, status;
+    cl_program p;
+    long len;
+    size_t sz;
+    unsigned char* bin;
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len <= 0) {
+        fclose(f);
+        return NULL;
+    }
+    sz = (size_t)len;
+    bin = (unsigned char*)malloc(sz);
+    if (fread(bin, 1, sz, f) != sz) {
+        free(bin);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    p = clCreateProgramWithBinary(
+        gpu->ctx, 1, gpu->dev_ids, &sz,
+        (const unsigned char**)&bin, &status, &err);
+    free(bin);
+    if (err != CL_SUCCESS) return NULL;
+    if (status == CL_SUCCESS) {
+        err = clBuildProgram(p, 1, gpu->dev_ids, options, NULL, NULL);
+        if (err == CL_SUCCESS) return p;
+    }
+    clReleaseProgram(p);
+    return NULL;
+}
+
+// best effort, the cache is just skipped if it isn't writable.
+static void
+save_binary(
+    yapd_gpu_t* gpu, cl_program p, const char* path)
+{
+    cl_int err;
+    size_t sz;
+    unsigned char* bin;
+    char tmp[YAPD_GPU_CACHE_PATH + 64];
+    FILE* f;
+    err = clGetProgramInfo(
+        p, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &sz, NULL);
+    assert(err == CL_SUCCESS);
+    if (sz == 0) return;
+    bin = (unsigned char*)malloc(sz);
+    err = clGetProgramInfo(
+        p, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &bin, NULL);
+    assert(err == CL_SUCCESS);
+    // write then rename, so other processes never see a partial binary,
+    // the temporary is unique to the process and program, so that
+    // concurrent writers of the same cache never share it
+    snprintf(tmp, sizeof(tmp), "%s.%d.%p.tmp", path, (int)getpid(), (void*)p);
+    f = fopen(tmp, "wb");
+    if (f) {
+        const int ok = fwrite(bin, 1, sz, f) == sz;
+        fclose(f);
+        remove(path);
+        if (!ok || rename(tmp, path) != 0) remove(tmp);
+    }
+    free(bin);
+}
+
 cl_program
 yapd_gpu_load_program(
-    yapd_gpu_t* gpu, const char* source)
+    yapd_gpu_t* gpu, const char* source, const char* options)
 {
     cl_int err;
     cl_program p;
     const char* strings[] = { source };
+    char path[YAPD_GPU_CACHE_PATH];
+    assert(gpu->backend == YAPD_BACKEND_OPENCL);
+    if (gpu->cache_dir[0]) {
+        cache_path(gpu, source, options, path);
+        p = load_binary(gpu, path, options);
+        if (p) return p;
+    }
     p = clCreateProgramWithSource(gpu->ctx, 1, strings, NULL, &err);
     assert(err == CL_SUCCESS);
-    err = clBuildProgram(p, 1, gpu->dev_ids, NULL, NULL, NULL);
+    err = clBuildProgram(p, 1, gpu->dev_ids, options, NULL, NULL);
     if (err != CL_SUCCESS) {
         size_t len;
         err = clGetProgramBuildInfo(
@@ -115,6 +447,7 @@ yapd_gpu_load_program(
         free(log);
         assert(!"failed to build program");
     }
+    if (gpu->cache_dir[0]) save_binary(gpu, p, path);
     return p;
 }
 
@@ -122,6 +455,7 @@ void
 yapd_gpu_sync(
     yapd_gpu_t* gpu)
 {
+    if (gpu->backend == YAPD_BACKEND_CPU) return;
     clFinish(gpu->queue);
 }
 
@@ -129,6 +463,7 @@ void
 yapd_gpu_release(
     yapd_gpu_t* gpu)
 {
+    if (gpu->backend == YAPD_BACKEND_CPU) return;
     yapd_gpu_release_color(gpu);
     yapd_gpu_release_resample(gpu);
     yapd_gpu_release_convolution(gpu);
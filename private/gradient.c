@@ -1,16 +1,21 @@
 /* Copyright (c) 2018 Giang "Yakiro" Nguyen. All rights reserved. */
-#include <yapd/buffer.h>
+#include <yapd/gradient.h>
 
+#include <yapd/buffer.h>
 #include <yapd/gpu.h>
+#include <cpu/cpu.h>
 #include <gradient.cl.h>
 
+#include <stdio.h>
+#include <math.h>
+
 void
 yapd_gpu_setup_gradient(
     yapd_gpu_t* gpu)
 {
     cl_int err;
     yapd_gpu_gradient_ctx_t* c = &gpu->gradient;
-    c->program = yapd_gpu_load_program(gpu, gradient_cl);
+    c->program = yapd_gpu_load_program(gpu, gradient_cl, NULL);
     c->grad_mag32fc4 = clCreateKernel(c->program, "grad_mag32fc4", &err);
     assert(err == CL_SUCCESS);
     c->grad_mag_norm = clCreateKernel(c->program, "grad_mag_norm", &err);
@@ -19,18 +24,64 @@ yapd_gpu_setup_gradient(
     assert(err == CL_SUCCESS);
     c->grad_hist = clCreateKernel(c->program, "grad_hist", &err);
     assert(err == CL_SUCCESS);
+    c->grad_norm_hist32fc4 = clCreateKernel(
+        c->program, "grad_norm_hist32fc4", &err);
+    assert(err == CL_SUCCESS);
 }
 
 void
 yapd_gpu_release_gradient(
     yapd_gpu_t* gpu)
 {
+    int i;
     yapd_gpu_gradient_ctx_t* c = &gpu->gradient;
     clReleaseKernel(c->grad_mag32fc4);
     clReleaseKernel(c->grad_mag_norm);
     clReleaseKernel(c->grad_scale_angle);
     clReleaseKernel(c->grad_hist);
+    clReleaseKernel(c->grad_norm_hist32fc4);
     clReleaseProgram(c->program);
+    for (i = 0; i < c->num_variants; ++i) {
+        clReleaseKernel(c->variants[i].grad_hist);
+        clReleaseKernel(c->variants[i].grad_norm_hist32fc4);
+        clReleaseProgram(c->variants[i].program);
+    }
+    c->num_variants = 0;
+}
+
+// grad_hist (or fused grad_norm_hist32fc4) specialized for given bin size
+// and orientations.
+static cl_kernel
+hist_kernel(
+    yapd_gpu_t* gpu, int bin_size, int num_orients, int fused)
+{
+    int i;
+    cl_int err;
+    char options[64];
+    yapd_gpu_hist_variant_t* v;
+    yapd_gpu_gradient_ctx_t* c = &gpu->gradient;
+    for (i = 0; i < c->num_variants; ++i) {
+        v = c->variants + i;
+        if (v->bin_size == bin_size && v->num_orients == num_orients) {
+            return fused ? v->grad_norm_hist32fc4 : v->grad_hist;
+        }
+    }
+    if (c->num_variants == YAPD_GPU_MAX_VARIANTS) {
+        return fused ? c->grad_norm_hist32fc4 : c->grad_hist;
+    }
+    v = c->variants + c->num_variants++;
+    v->bin_size = bin_size;
+    v->num_orients = num_orients;
+    snprintf(
+        options, sizeof(options), "-DBIN_SIZE=%d -DNUM_ORIENTS=%d",
+        bin_size, num_orients);
+    v->program = yapd_gpu_load_program(gpu, gradient_cl, options);
+    v->grad_hist = clCreateKernel(v->program, "grad_hist", &err);
+    assert(err == CL_SUCCESS);
+    v->grad_norm_hist32fc4 = clCreateKernel(
+        v->program, "grad_norm_hist32fc4", &err);
+    assert(err == CL_SUCCESS);
+    return fused ? v->grad_norm_hist32fc4 : v->grad_hist;
 }
 
 void
@@ -44,10 +95,17 @@ yapd_gradient_mag32fc4(
     size_t size[] = { sz->w, sz->h, 1 };
     yapd_gpu_gradient_ctx_t* c = &gpu->gradient;
 
-    assert(gpu == mag->gpu && gpu == angle->gpu);
+    assert(gpu == mag->gpu);
     assert(img->bytes >= sizeof(cl_float4)*sz->w*sz->h);
     assert(mag->bytes >= sizeof(float)*sz->w*sz->h);
-    assert(angle->bytes >= sizeof(float)*sz->w*sz->h);
+    assert(!angle || angle->bytes >= sizeof(float)*sz->w*sz->h);
+
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        yapd_cpu_grad_mag32fc4(
+            gpu, (float*)img->host, sz,
+            (float*)mag->host, angle ? (float*)angle->host : NULL);
+        return;
+    }
 
     err = clSetKernelArg(c->grad_mag32fc4, 0, sizeof(cl_mem), &img->mem);
     assert(err == CL_SUCCESS);
@@ -55,7 +113,8 @@ yapd_gradient_mag32fc4(
     assert(err == CL_SUCCESS);
     err = clSetKernelArg(c->grad_mag32fc4, 2, sizeof(cl_mem), &mag->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->grad_mag32fc4, 3, sizeof(cl_mem), &angle->mem);
+    err = clSetKernelArg(
+        c->grad_mag32fc4, 3, sizeof(cl_mem), angle ? &angle->mem : NULL);
     assert(err == CL_SUCCESS);
 
     err = clEnqueueNDRangeKernel(
@@ -78,6 +137,12 @@ yapd_gradient_mag_norm(
     yapd_buffer_conv_tri_cols32f(tmp, mag, off, sz, r, filter);
     yapd_buffer_conv_tri_rows32f(tmp, 0, off, sz, r, filter);
 
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        yapd_cpu_grad_mag_norm(
+            gpu, (float*)mag->host, (float*)tmp->host, sz, norm_const);
+        return;
+    }
+
     err = clSetKernelArg(c->grad_mag_norm, 0, sizeof(cl_mem), &mag->mem);
     assert(err == CL_SUCCESS);
     err = clSetKernelArg(c->grad_mag_norm, 1, sizeof(cl_mem), &tmp->mem);
@@ -104,6 +169,11 @@ yapd_gradient_scale_angle(
 
     assert(angle->bytes >= sizeof(float)*sz->w*sz->h);
 
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        yapd_cpu_grad_scale_angle(gpu, (float*)angle->host, sz, scale);
+        return;
+    }
+
     err = clSetKernelArg(c->grad_scale_angle, 0, sizeof(cl_mem), &angle->mem);
     assert(err == CL_SUCCESS);
     err = clSetKernelArg(c->grad_scale_angle, 1, sizeof(cl_int2), sz);
@@ -122,30 +192,127 @@ yapd_gradient_hist(
     const yapd_size_t* sz, int bin_size, int num_orients)
 {
     cl_int err;
+    cl_kernel k;
     yapd_gpu_t* gpu = hist->gpu;
     size_t offset[] = { 0, 0, 0 };
     size_t size[] = { sz->w, sz->h, 1 };
-    yapd_gpu_gradient_ctx_t* c = &gpu->gradient;
 
     assert(gpu == mag->gpu && gpu == angle->gpu);
     assert(hist->bytes >= sizeof(cl_float8)*sz->w*sz->h);
     assert(mag->bytes >= sizeof(float)*sz->w*bin_size*sz->h*bin_size);
     assert(angle->bytes >= sizeof(float)*sz->w*bin_size*sz->h*bin_size);
 
-    err = clSetKernelArg(c->grad_hist, 0, sizeof(cl_mem), &hist->mem);
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        yapd_cpu_grad_hist(
+            gpu, (float*)hist->host, (float*)mag->host,
+            (float*)angle->host, sz, bin_size, num_orients);
+        return;
+    }
+
+    k = hist_kernel(gpu, bin_size, num_orients, FALSE);
+    err = clSetKernelArg(k, 0, sizeof(cl_mem), &hist->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->grad_hist, 1, sizeof(cl_mem), &mag->mem);
+    err = clSetKernelArg(k, 1, sizeof(cl_mem), &mag->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->grad_hist, 2, sizeof(cl_mem), &angle->mem);
+    err = clSetKernelArg(k, 2, sizeof(cl_mem), &angle->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->grad_hist, 3, sizeof(cl_int2), sz);
+    err = clSetKernelArg(k, 3, sizeof(cl_int2), sz);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->grad_hist, 4, sizeof(int), &bin_size);
+    err = clSetKernelArg(k, 4, sizeof(int), &bin_size);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->grad_hist, 5, sizeof(int), &num_orients);
+    err = clSetKernelArg(k, 5, sizeof(int), &num_orients);
     assert(err == CL_SUCCESS);
 
     err = clEnqueueNDRangeKernel(
-        gpu->queue, c->grad_hist, 2, offset, size, NULL, 0, NULL, NULL);
+        gpu->queue, k, 2, offset, size, NULL, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
-}
\ No newline at end of file
+}
+
+void
+yapd_acos_lut(
+    yapd_alloc_t a, void* aud, float** lut, int* bytes)
+{
+    int i;
+    const int n = YAPD_ACOS_LUT_SIZE;
+    *bytes = n * sizeof(float);
+    *lut = (float*)a.alloc(aud, *bytes, YAPD_DEFAULT_ALIGN);
+    for (i = 0; i < n; ++i) {
+        (*lut)[i] = (float)acos(2.0 * i / (n - 1) - 1.0);
+    }
+}
+
+void
+yapd_gradient_norm_hist32fc4(
+    const yapd_buffer_view_t* hist, yapd_buffer_t* img, yapd_buffer_t* mag,
+    const yapd_size_t* sz, yapd_buffer_t* tmp, float norm_const,
+    int r, yapd_buffer_t* filter, int bin_size, int num_orients,
+    yapd_buffer_t* acos_lut)
+{
+    cl_int err;
+    cl_kernel k;
+    yapd_gpu_t* gpu = hist->buf->gpu;
+    size_t offset[] = { 0, 0, 0 };
+    size_t size[] = { sz->w, sz->h, 1 };
+    const yapd_size_t sz0 = { sz->w*bin_size, sz->h*bin_size };
+    const cl_int4 view = {{
+        hist->pitch, hist->offset, hist->cell, hist->lane }};
+    const float scale = num_orients / CL_M_PI_F;
+    const int lut_size = acos_lut->bytes / sizeof(float);
+
+    assert(gpu == img->gpu && gpu == mag->gpu && gpu == tmp->gpu);
+    assert(gpu == acos_lut->gpu);
+    // compact feature cells have room for 6 orientations only
+    assert(hist->lane + 8 <= hist->cell ||
+        (num_orients <= 6 && hist->lane + 6 == hist->cell));
+    assert(hist->buf->bytes >= sizeof(float)*hist->cell*
+        (hist->offset + (sz->h - 1)*hist->pitch + sz->w));
+    assert(img->bytes >= sizeof(cl_float4)*sz0.w*sz0.h);
+    assert(mag->bytes >= sizeof(float)*sz0.w*sz0.h);
+    assert(tmp->bytes >= sizeof(float)*sz0.w*sz0.h*2);
+
+    // normalization factor, same as yapd_gradient_mag_norm
+    int off = sz0.w*sz0.h;
+    yapd_buffer_conv_tri_cols32f(tmp, mag, off, &sz0, r, filter);
+    yapd_buffer_conv_tri_rows32f(tmp, 0, off, &sz0, r, filter);
+
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        yapd_cpu_grad_norm_hist32fc4(
+            gpu, (float*)hist->buf->host + hist->offset*hist->cell +
+            hist->lane, hist->pitch*hist->cell, hist->cell,
+            YAPD_MIN(8, hist->cell - hist->lane),
+            (float*)img->host, (float*)mag->host,
+            (float*)tmp->host, sz, norm_const, scale, bin_size, num_orients,
+            (float*)acos_lut->host, lut_size);
+        return;
+    }
+
+    k = hist_kernel(gpu, bin_size, num_orients, TRUE);
+    err = clSetKernelArg(k, 0, sizeof(cl_mem), &hist->buf->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 1, sizeof(cl_int4), &view);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 2, sizeof(cl_mem), &img->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 3, sizeof(cl_mem), &mag->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 4, sizeof(cl_mem), &tmp->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 5, sizeof(cl_int2), sz);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 6, sizeof(float), &norm_const);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 7, sizeof(float), &scale);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 8, sizeof(int), &bin_size);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 9, sizeof(int), &num_orients);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 10, sizeof(cl_mem), &acos_lut->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 11, sizeof(int), &lut_size);
+    assert(err == CL_SUCCESS);
+
+    err = clEnqueueNDRangeKernel(
+        gpu->queue, k, 2, offset, size, NULL, 0, NULL, NULL);
+    assert(err == CL_SUCCESS);
+}
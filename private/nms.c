@@ -24,7 +24,7 @@ yapd_nms(
     // bubble sort
     while (TRUE) {
         int done = TRUE;
-        for (i = bbs->size.h; i > 0; --i) {
+        for (i = bbs->size.h - 1; i > 0; --i) {
             float* const l = (float*)bbs->data + (i - 1) * 5;
             float* const r = (float*)bbs->data + (i + 0) * 5;
             if (l[4] < r[4]) {
@@ -1,12 +1,10 @@
 /* Copyright (c) 2018 Giang "Yakiro" Nguyen. All rights reserved. */
 
-__kernel void luv_from_rgb8uc4(
+float4 luv(
+    const uchar4 src_color,
     const float minu, const float minv, const float un, const float vn,
-    const float4 mr, const float4 mg, const float4 mb, __constant float* ltable,
-    __global float4* dst, __global uchar4* src)
+    const float4 mr, const float4 mg, const float4 mb, __constant float* ltable)
 {
-    const int i = get_global_id(0);
-    const uchar4 src_color = src[i];
     const float r = src_color.s0;
     const float g = src_color.s1;
     const float b = src_color.s2;
@@ -15,9 +13,66 @@ __kernel void luv_from_rgb8uc4(
     float z = mr.s2*r + mg.s2*g + mb.s2*b;
     float l = ltable[(int)(y*1024)];
     z = 1.0f / (x + 15.0f*y + 3.0f*z + 1e-35f);
-    dst[i] = (float4)(
+    return (float4)(
         l,
         l*(13.0f*4.0f*x*z - 13.0f*un) - minu,
         l*(13.0f*9.0f*y*z - 13.0f*vn) - minv,
         0.0f);
 }
+
+int border1(const int x, const int n)
+{
+    // symmetric padding
+    return x < 0 ? -x : (x < n ? x : (2*n - x - 2));
+}
+
+#define LUV(c) luv(c, minu, minv, un, vn, mr, mg, mb, ltable)
+
+__kernel void luv_from_rgb8uc4(
+    const float minu, const float minv, const float un, const float vn,
+    const float4 mr, const float4 mg, const float4 mb, __constant float* ltable,
+    __global float4* dst, __global uchar4* src)
+{
+    const int i = get_global_id(0);
+    dst[i] = LUV(src[i]);
+}
+
+// fused LUV conversion, bilinear resample from `src_sz` to `dst_sz` and
+// column pass of triangle filter, so LUV image of the source size is never
+// stored. Same as luv_from_rgb8uc4, resample32fc4 then conv_tri32fc4.
+__kernel void luv_smooth_cols_rgb8uc4(
+    const float minu, const float minv, const float un, const float vn,
+    const float4 mr, const float4 mg, const float4 mb, __constant float* ltable,
+    const int r, __constant float* filter,
+    __global float4* dst, const int2 dst_sz,
+    __global uchar4* src, const int2 src_sz)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const int same = dst_sz.s0 == src_sz.s0 && dst_sz.s1 == src_sz.s1;
+    const float gx = x / (float)dst_sz.s0 * (src_sz.s0 - 1);
+    const int gxi = (int)gx;
+    const float tx = gx - gxi;
+    float4 sum = (float4)0.0f;
+    for (int i = -r; i <= r; ++i) {
+        const int yi = border1(y + i, dst_sz.s1);
+        float4 c;
+        if (same) {
+            c = LUV(src[yi*src_sz.s0 + x]);
+        } else {
+            const float gy = yi / (float)dst_sz.s1 * (src_sz.s1 - 1);
+            const int gyi = (int)gy;
+            const float ty = gy - gyi;
+            __global uchar4* s0 = src + gyi*src_sz.s0 + gxi;
+            __global uchar4* s1 = s0 + src_sz.s0;
+            const float4 c00 = LUV(s0[0]);
+            const float4 c10 = LUV(s0[1]);
+            const float4 c01 = LUV(s1[0]);
+            const float4 c11 = LUV(s1[1]);
+            c = mix(mix(c00, c10, tx), mix(c01, c11, tx), ty);
+        }
+        // no filter is read without smoothing
+        sum += r > 0 ? c*filter[i + r] : c;
+    }
+    dst[y*dst_sz.s0 + x] = sum;
+}
@@ -8,6 +8,47 @@ int2 border(const int2 pos, const int2 sz)
         pos.y < 0 ? -pos.y : (pos.y < sz.s1 ? pos.y : (2*sz.s1 - pos.y - 2)));
 }
 
+int border1(const int x, const int n)
+{
+    // symmetric padding
+    return x < 0 ? -x : (x < n ? x : (2*n - x - 2));
+}
+
+// triangle filter is box filter of [-r, 0] followed by box filter of [0, r],
+// computed as running sums, one work item per line of `n` floats `step`
+// apart. `lag` and `lead` are first box sums at i and i + r + 1.
+__kernel void conv_tri_sum32f(
+    const int r, const int n, const int step, const int2 line_step,
+    __global float* dst, const int dst_off,
+    __global float* src, const int src_off)
+{
+    const int base =
+        get_global_id(0)*line_step.s0 + get_global_id(1)*line_step.s1;
+    __global float* s = src + src_off + base;
+    __global float* d = dst + dst_off + base;
+    const float nrm = 1.0f / ((r + 1)*(r + 1));
+    float lag = 0.0f, lead, sum;
+    for (int i = -r; i <= 0; ++i) {
+        lag += s[border1(i, n)*step];
+    }
+    lead = sum = lag;
+    for (int i = 1; i <= r; ++i) {
+        lead += s[border1(i, n)*step];
+        lead -= s[border1(i - r - 1, n)*step];
+        sum += lead;
+    }
+    for (int i = 0; i < n; ++i) {
+        d[i*step] = sum*nrm;
+        if (i + 1 == n) break;
+        lead += s[border1(i + r + 1, n)*step];
+        lead -= s[border1(i, n)*step];
+        sum += lead;
+        sum -= lag;
+        lag += s[border1(i + 1, n)*step];
+        lag -= s[border1(i - r, n)*step];
+    }
+}
+
 __kernel void conv_tri_cols32f(
     const int r, __constant float* filter, const int2 sz,
     __global float* dst, const int dst_off, __global float* src)
@@ -91,3 +132,181 @@ __kernel void conv_tri32fc16(
     }
     dst[pos.y*sz.s0 + pos.x] = sum;
 }
+
+// compact feature cells, 10 floats as float8 and float2.
+__kernel void conv_tri32fc10(
+    const int r, const int2 dir, __constant float* filter,
+    const int2 sz, __global float* dst, __global float* src)
+{
+    const int2 pos = { get_global_id(0), get_global_id(1) };
+    float8 sum = (float8)0.0f;
+    float2 sum2 = (float2)0.0f;
+    for (int i = -r; i <= r; ++i) {
+        int2 p = border(pos + dir*i, sz);
+        __global float* s = src + (p.y*sz.s0 + p.x)*10;
+        sum += vload8(0, s)*filter[i + r];
+        sum2 += vload2(4, s)*filter[i + r];
+    }
+    __global float* d = dst + (pos.y*sz.s0 + pos.x)*10;
+    vstore8(sum, 0, d);
+    vstore2(sum2, 4, d);
+}
+
+// tiled variant, stages the work-group tile plus its halo in local memory,
+// so symmetric border is resolved once per loaded pixel instead of per tap.
+void conv_tiled32f(
+    const int r, const int2 dir, __constant float* filter, const int2 sz,
+    __global float* dst, __global float* src, __local float* tile)
+{
+    const int2 pos = { get_global_id(0), get_global_id(1) };
+    const int2 lpos = { get_local_id(0), get_local_id(1) };
+    const int2 lsz = { get_local_size(0), get_local_size(1) };
+    const int2 tsz = lsz + dir*2*r;
+    const int2 org = pos - lpos - dir*r;
+    for (int y = lpos.y; y < tsz.y; y += lsz.y) {
+        for (int x = lpos.x; x < tsz.x; x += lsz.x) {
+            // clamped, global size is rounded up to the work-group size
+            const int2 p = clamp(
+                border(org + (int2)(x, y), sz), (int2)0, sz - (int2)1);
+            tile[y*tsz.x + x] = src[p.y*sz.s0 + p.x];
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (pos.x >= sz.s0 || pos.y >= sz.s1) return;
+    float sum = (float)0.0f;
+    for (int i = 0; i <= 2*r; ++i) {
+        const int2 t = lpos + dir*i;
+        sum += tile[t.y*tsz.x + t.x]*filter[i];
+    }
+    dst[pos.y*sz.s0 + pos.x] = sum;
+}
+
+void conv_tiled32fc4(
+    const int r, const int2 dir, __constant float* filter, const int2 sz,
+    __global float4* dst, __global float4* src, __local float4* tile)
+{
+    const int2 pos = { get_global_id(0), get_global_id(1) };
+    const int2 lpos = { get_local_id(0), get_local_id(1) };
+    const int2 lsz = { get_local_size(0), get_local_size(1) };
+    const int2 tsz = lsz + dir*2*r;
+    const int2 org = pos - lpos - dir*r;
+    for (int y = lpos.y; y < tsz.y; y += lsz.y) {
+        for (int x = lpos.x; x < tsz.x; x += lsz.x) {
+            // clamped, global size is rounded up to the work-group size
+            const int2 p = clamp(
+                border(org + (int2)(x, y), sz), (int2)0, sz - (int2)1);
+            tile[y*tsz.x + x] = src[p.y*sz.s0 + p.x];
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (pos.x >= sz.s0 || pos.y >= sz.s1) return;
+    float4 sum = (float4)0.0f;
+    for (int i = 0; i <= 2*r; ++i) {
+        const int2 t = lpos + dir*i;
+        sum += tile[t.y*tsz.x + t.x]*filter[i];
+    }
+    dst[pos.y*sz.s0 + pos.x] = sum;
+}
+
+void conv_tiled32fc8(
+    const int r, const int2 dir, __constant float* filter, const int2 sz,
+    __global float8* dst, __global float8* src, __local float8* tile)
+{
+    const int2 pos = { get_global_id(0), get_global_id(1) };
+    const int2 lpos = { get_local_id(0), get_local_id(1) };
+    const int2 lsz = { get_local_size(0), get_local_size(1) };
+    const int2 tsz = lsz + dir*2*r;
+    const int2 org = pos - lpos - dir*r;
+    for (int y = lpos.y; y < tsz.y; y += lsz.y) {
+        for (int x = lpos.x; x < tsz.x; x += lsz.x) {
+            // clamped, global size is rounded up to the work-group size
+            const int2 p = clamp(
+                border(org + (int2)(x, y), sz), (int2)0, sz - (int2)1);
+            tile[y*tsz.x + x] = src[p.y*sz.s0 + p.x];
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (pos.x >= sz.s0 || pos.y >= sz.s1) return;
+    float8 sum = (float8)0.0f;
+    for (int i = 0; i <= 2*r; ++i) {
+        const int2 t = lpos + dir*i;
+        sum += tile[t.y*tsz.x + t.x]*filter[i];
+    }
+    dst[pos.y*sz.s0 + pos.x] = sum;
+}
+
+void conv_tiled32fc16(
+    const int r, const int2 dir, __constant float* filter, const int2 sz,
+    __global float16* dst, __global float16* src, __local float16* tile)
+{
+    const int2 pos = { get_global_id(0), get_global_id(1) };
+    const int2 lpos = { get_local_id(0), get_local_id(1) };
+    const int2 lsz = { get_local_size(0), get_local_size(1) };
+    const int2 tsz = lsz + dir*2*r;
+    const int2 org = pos - lpos - dir*r;
+    for (int y = lpos.y; y < tsz.y; y += lsz.y) {
+        for (int x = lpos.x; x < tsz.x; x += lsz.x) {
+            // clamped, global size is rounded up to the work-group size
+            const int2 p = clamp(
+                border(org + (int2)(x, y), sz), (int2)0, sz - (int2)1);
+            tile[y*tsz.x + x] = src[p.y*sz.s0 + p.x];
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (pos.x >= sz.s0 || pos.y >= sz.s1) return;
+    float16 sum = (float16)0.0f;
+    for (int i = 0; i <= 2*r; ++i) {
+        const int2 t = lpos + dir*i;
+        sum += tile[t.y*tsz.x + t.x]*filter[i];
+    }
+    dst[pos.y*sz.s0 + pos.x] = sum;
+}
+
+__kernel void conv_tri_cols32f_tiled(
+    const int r, __constant float* filter, const int2 sz,
+    __global float* dst, const int dst_off, __global float* src,
+    __local float* tile)
+{
+    conv_tiled32f(r, (int2)(0, 1), filter, sz, dst + dst_off, src, tile);
+}
+
+__kernel void conv_tri_rows32f_tiled(
+    const int r, __constant float* filter, const int2 sz,
+    __global float* buf, const int dst_off, const int src_off,
+    __local float* tile)
+{
+    conv_tiled32f(
+        r, (int2)(1, 0), filter, sz, buf + dst_off, buf + src_off, tile);
+}
+
+__kernel void conv_tri32f_tiled(
+    const int r, const int2 dir, __constant float* filter,
+    const int2 sz, __global float* dst, __global float* src,
+    __local float* tile)
+{
+    conv_tiled32f(r, dir, filter, sz, dst, src, tile);
+}
+
+__kernel void conv_tri32fc4_tiled(
+    const int r, const int2 dir, __constant float* filter,
+    const int2 sz, __global float4* dst, __global float4* src,
+    __local float4* tile)
+{
+    conv_tiled32fc4(r, dir, filter, sz, dst, src, tile);
+}
+
+__kernel void conv_tri32fc8_tiled(
+    const int r, const int2 dir, __constant float* filter,
+    const int2 sz, __global float8* dst, __global float8* src,
+    __local float8* tile)
+{
+    conv_tiled32fc8(r, dir, filter, sz, dst, src, tile);
+}
+
+__kernel void conv_tri32fc16_tiled(
+    const int r, const int2 dir, __constant float* filter,
+    const int2 sz, __global float16* dst, __global float16* src,
+    __local float16* tile)
+{
+    conv_tiled32fc16(r, dir, filter, sz, dst, src, tile);
+}
@@ -1,133 +1,466 @@
 /* Copyright (c) 2018 Giang "Yakiro" Nguyen. All rights reserved. */
 
 #define TREE_NODES 8
+// at most, trees of the first stage are staged in local memory
 #define EARLY_WEAKS 32
+#define WIN_TILE_W 8
+#define WIN_TILE_H 8
+#define SCAN_GROUP 128
+#define SCAN_BLOCK (2*SCAN_GROUP)
+#define PREDICT_GROUP 64
 
-void get_child(
-    __global float* thrs,
-    __global int* fids,
+// specialized variants are built with -DTREE_DEPTH, so that tree traversal
+// is fully unrolled, runtime `depth` argument is ignored then.
+#ifdef TREE_DEPTH
+#define DEPTH TREE_DEPTH
+#else
+#define DEPTH depth
+#endif
+
+// same values as yapd_feature_storage_t.
+#define FEATURE_HALF 1
+#define FEATURE_U8 2
+
+// tree node, same layout as yapd_detector_node_t.
+typedef struct node_s {
+    int fid; // row of window << 16 | float of the row
+    float thr;
+    int qthr; // for bytes
+    float h;
+} node_t;
+
+// layout of a pyramid scale, same as yapd_detector_scale_t. Scales are
+// followed by a sentinel whose offsets are the totals.
+typedef struct scale_s {
+    int chns_off; // first feature of the slot
+    int org_w;
+    int org_h;
+    int out_w;
+    int out_h;
+    int out_off; // first window
+    int group_off; // first work-group of tiled early rejection
+} scale_t;
+
+#define SCALE_OUT_OFF 5
+#define SCALE_GROUP_OFF 6
+
+// last scale whose offset `field` is at most `i`.
+int find_scale(
+    __constant scale_t* scales,
+    const int num_scales,
+    const int field,
+    const int i)
+{
+    int lo = 0, hi = num_scales - 1;
+    while (lo < hi) {
+        const int m = (lo + hi + 1) / 2;
+        if (((__constant int*)(scales + m))[field] <= i) lo = m;
+        else hi = m - 1;
+    }
+    return lo;
+}
+
+// child (1 or 2) of node `n` for window at `chns_off` in rows of `row`
+// floats, bytes are compared to quantized thresholds.
+int child(
+    const node_t n,
     __global float* chns,
-    __global int* cids,
-    const int off,
-    int* k0, int* k)
+    const int chns_off,
+    const int row,
+    const int storage)
+{
+    const int i = chns_off + (n.fid >> 16)*row + (n.fid & 0xffff);
+    // half slots are read by vload_half, no cl_khr_fp16 needed
+    if (storage == FEATURE_HALF) {
+        return vload_half(i, (__global half*)chns) < n.thr ? 1 : 2;
+    }
+    if (storage == FEATURE_U8) {
+        return ((__global uchar*)chns)[i] < n.qthr ? 1 : 2;
+    }
+    return chns[i] < n.thr ? 1 : 2;
+}
+
+// same as child for a feature tile in local memory.
+int child_tile(
+    const node_t n,
+    __local uchar* tile,
+    const int tile_off,
+    const int row,
+    const int storage)
 {
-    float ftr = chns[cids[fids[*k]]];
-    *k = ftr < thrs[*k] ? 1 : 2;
-    *k0 = *k += (*k0)*2; *k += off;
+    const int i = tile_off + (n.fid >> 16)*row + (n.fid & 0xffff);
+    if (storage == FEATURE_HALF) {
+        return vload_half(i, (__local half*)tile) < n.thr ? 1 : 2;
+    }
+    if (storage == FEATURE_U8) return tile[i] < n.qthr ? 1 : 2;
+    return ((__local float*)tile)[i] < n.thr ? 1 : 2;
 }
 
+// whether window at `pos` of scale `s` neighbours a window of the coarse
+// grid, `coarse` times sparser, whose early score passed `coarse_thr`. The
+// coarse window `c` covers windows closer than `coarse` to `c*coarse`.
+int near_coarse(
+    const int coarse,
+    __constant scale_t* s,
+    __global float* coarse_out,
+    const float coarse_thr,
+    const int2 pos)
+{
+    const int2 lo = pos / coarse;
+    const int2 hi = min(
+        (pos + coarse - 1) / coarse, (int2)(s->out_w - 1, s->out_h - 1));
+    __global float* o = coarse_out + s->out_off;
+    return
+        o[lo.y*s->out_w + lo.x] > coarse_thr ||
+        o[lo.y*s->out_w + hi.x] > coarse_thr ||
+        o[hi.y*s->out_w + lo.x] > coarse_thr ||
+        o[hi.y*s->out_w + hi.x] > coarse_thr;
+}
+
+// early trees are shared by all windows, they are copied into local memory
+// once per work-group. Windows of all scales are flattened, global size is
+// rounded up. With `coarse` > 0, only windows near survivors of a coarse
+// pass are evaluated.
 __kernel void detector_early_reject(
     const int depth,
     const int to_org,
-    const int org_w,
-    const int out_w,
+    const int num_scales,
+    __constant scale_t* scales,
     const float casc_thr,
-    __global float* thrs,
-    __global float* hs,
-    __global int* fids,
+    __global node_t* nodes,
     __global float* chns,
-    __global int* cids,
     __global float* out,
     __global int* tmp,
-    const int off)
+    const int cell,
+    const int storage,
+    const int num_early,
+    const int coarse,
+    __constant scale_t* coarse_scales,
+    __global float* coarse_out,
+    const float coarse_thr)
 {
-    const int2 pos = { get_global_id(0), get_global_id(1) };
+    __local int4 early_nodes[EARLY_WEAKS*TREE_NODES];
+    __local node_t* early = (__local node_t*)early_nodes;
+    const int out_idx = get_global_id(0);
+    const int k = find_scale(scales, num_scales, SCALE_OUT_OFF, out_idx);
+    __constant scale_t* s = scales + k;
+    const int j = out_idx - s->out_off;
+    const int2 pos = { j % s->out_w, j / s->out_w };
     const int2 org_pos = pos*to_org;
-    const int chns_off = (org_pos.y*org_w + org_pos.x)*16;
-    const int out_idx = off + pos.y*out_w + pos.x;
+    const int chns_off = s->chns_off + (org_pos.y*s->org_w + org_pos.x)*cell;
+    event_t e = async_work_group_copy(
+        early_nodes, (__global int4*)nodes, EARLY_WEAKS*TREE_NODES, 0);
+    float h = 0.0f;
+    int live;
+    wait_group_events(1, &e);
+    if (out_idx >= scales[num_scales].out_off) return;
+    live = coarse == 0 || near_coarse(
+        coarse, coarse_scales + k, coarse_out, coarse_thr, pos);
+    for (int t = 0; live && t < num_early; ++t) {
+        __local node_t* tree = early + t*TREE_NODES;
+        int n = 0;
+        for (int i = 0; i < DEPTH; ++i) {
+            n = n*2 + child(tree[n], chns, chns_off, s->org_w*cell, storage);
+        }
+        h += tree[n].h; if (h <= casc_thr) break;
+    }
+    // skipped windows are rejected at the threshold, as early_bbs reads out
+    out[out_idx] = live ? h : casc_thr;
+    tmp[out_idx] = live && h > casc_thr;
+}
+
+// a work-group covers WIN_TILE_W x WIN_TILE_H windows, which overlap
+// almost entirely in features, the union of their cells is copied into
+// `tile` once then early trees read only local memory. Blocks of all
+// scales are flattened, `win` is the window size in cells. Work-groups with
+// no window near survivors of a coarse pass skip their copies.
+__kernel __attribute__((reqd_work_group_size(WIN_TILE_W*WIN_TILE_H, 1, 1)))
+void detector_early_reject_tiled(
+    const int depth,
+    const int to_org,
+    const int num_scales,
+    __constant scale_t* scales,
+    const float casc_thr,
+    __global node_t* nodes,
+    __global uchar* chns,
+    __global float* out,
+    __global int* tmp,
+    const int cell,
+    const int storage,
+    const int2 win,
+    __local uchar* tile,
+    const int num_early,
+    const int coarse,
+    __constant scale_t* coarse_scales,
+    __global float* coarse_out,
+    const float coarse_thr)
+{
+    __local int4 early_nodes[EARLY_WEAKS*TREE_NODES];
+    __local node_t* early = (__local node_t*)early_nodes;
+    __local int any;
+    const int g = get_group_id(0);
+    const int k = find_scale(scales, num_scales, SCALE_GROUP_OFF, g);
+    __constant scale_t* s = scales + k;
+    const int tiles_w = (s->out_w + WIN_TILE_W - 1) / WIN_TILE_W;
+    const int2 grp = (int2)(
+        (g - s->group_off) % tiles_w, (g - s->group_off) / tiles_w)*
+        (int2)(WIN_TILE_W, WIN_TILE_H);
+    const int2 lpos = {
+        get_local_id(0) % WIN_TILE_W, get_local_id(0) / WIN_TILE_W };
+    const int2 pos = grp + lpos;
+    const int2 org = grp*to_org;
+    const int elem =
+        storage == FEATURE_U8 ? 1 : storage == FEATURE_HALF ? 2 : 4;
+    const int tile_w = (WIN_TILE_W - 1)*to_org + win.x;
+    const int tile_h = (WIN_TILE_H - 1)*to_org + win.y;
+    const int cols = min(tile_w, s->org_w - org.x)*cell*elem;
+    const int rows = min(tile_h, s->org_h - org.y);
+    const int row = tile_w*cell;
+    const int tile_off = (lpos.y*row + lpos.x*cell)*to_org;
+    const int out_idx = s->out_off + pos.y*s->out_w + pos.x;
+    __global uchar* src = chns + (s->chns_off + org.y*s->org_w*cell)*elem;
+    const int inside = pos.x < s->out_w && pos.y < s->out_h;
+    const int live = inside && (coarse == 0 || near_coarse(
+        coarse, coarse_scales + k, coarse_out, coarse_thr, pos));
+    event_t e;
     float h = 0.0f;
-    for (int t = 0; t < EARLY_WEAKS; ++t) {
-        const int off = t*TREE_NODES;
-        int k = off, k0 = 0;
-        for (int i = 0; i < depth; ++i) {
-            get_child(
-                thrs, fids, chns + chns_off,
-                cids, off, &k0, &k);
+    if (get_local_id(0) == 0) any = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (live) any = 1;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (!any) {
+        if (!inside) return;
+        out[out_idx] = casc_thr;
+        tmp[out_idx] = 0;
+        return;
+    }
+    e = async_work_group_copy(
+        early_nodes, (__global int4*)nodes, EARLY_WEAKS*TREE_NODES, 0);
+    for (int y = 0; y < rows; ++y) {
+        e = async_work_group_copy(
+            tile + y*row*elem,
+            src + ((y*s->org_w + org.x)*cell)*elem, cols, e);
+    }
+    wait_group_events(1, &e);
+    // padding windows of the last work-groups take part in copies only
+    if (!inside) return;
+    for (int t = 0; live && t < num_early; ++t) {
+        __local node_t* tree = early + t*TREE_NODES;
+        int n = 0;
+        for (int i = 0; i < DEPTH; ++i) {
+            n = n*2 + child_tile(tree[n], tile, tile_off, row, storage);
         }
-        h += hs[k]; if (h <= casc_thr) break;
+        h += tree[n].h; if (h <= casc_thr) break;
     }
-    out[out_idx] = h;
-    tmp[out_idx] = h > casc_thr;
+    out[out_idx] = live ? h : casc_thr;
+    tmp[out_idx] = live && h > casc_thr;
 }
 
-__kernel void detector_early_scan(
-    __global int* tmp, const int w, const int off,
-    __global int* idx, __global int* len, const int len_off)
+// work-efficient exclusive scan of SCAN_BLOCK ints of `s` by a work-group of
+// SCAN_GROUP, returns their sum.
+int scan_block(
+    __local int* s)
 {
-    const int y = get_global_id(0);
-    __global int* i = tmp + off + y*w; int a = i[0];
-    __global int* o = idx + off + y*w; o[0] = 0;
-    for (int j = 1; j < w; ++j) {
-        a += i[j]; o[j] = i[j - 1] + o[j - 1];
+    const int l = get_local_id(0);
+    int off = 1;
+    for (int d = SCAN_BLOCK >> 1; d > 0; d >>= 1) {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (l < d) s[off*(2*l + 2) - 1] += s[off*(2*l + 1) - 1];
+        off <<= 1;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const int sum = s[SCAN_BLOCK - 1];
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (l == 0) s[SCAN_BLOCK - 1] = 0;
+    for (int d = 1; d < SCAN_BLOCK; d <<= 1) {
+        off >>= 1;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (l < d) {
+            const int a = off*(2*l + 1) - 1;
+            const int b = off*(2*l + 2) - 1;
+            const int t = s[a]; s[a] = s[b]; s[b] += t;
+        }
     }
-    len[len_off + y] = a > 0 ? (o[w - 1] + (i[w - 1] == 1)) : 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    return sum;
 }
 
-__kernel void detector_early_prefix_sum(
-    __global int* len, __global int* sum, __constant int2* dsz)
+// rank of each surviving window of `n` within its block of SCAN_BLOCK,
+// and survivors of each block.
+__kernel __attribute__((reqd_work_group_size(SCAN_GROUP, 1, 1)))
+void detector_early_scan(
+    __global int* tmp, const int n, __global int* idx, __global int* blocks)
 {
-    const int s = get_global_id(0);
-    const int h = dsz[s].s0;
-    __global int* la = len + dsz[s].s1;
-    __global int* sa = sum + dsz[s].s1; sa[0] = 0;
-    for (int i = 1; i < h; ++i) {
-        sa[i] = la[i - 1] + sa[i - 1];
+    __local int s[SCAN_BLOCK];
+    const int l = get_local_id(0);
+    const int i = get_group_id(0)*SCAN_BLOCK + l;
+    s[l] = i < n ? tmp[i] : 0;
+    s[l + SCAN_GROUP] = i + SCAN_GROUP < n ? tmp[i + SCAN_GROUP] : 0;
+    const int sum = scan_block(s);
+    if (i < n) idx[i] = s[l];
+    if (i + SCAN_GROUP < n) idx[i + SCAN_GROUP] = s[l + SCAN_GROUP];
+    if (l == 0) blocks[get_group_id(0)] = sum;
+}
+
+// first survivor of each of `num_blocks` blocks by a single work-group,
+// `count[slot]` is the number of survivors.
+__kernel __attribute__((reqd_work_group_size(SCAN_GROUP, 1, 1)))
+void detector_early_prefix_sum(
+    __global int* blocks, const int num_blocks, __global int* count,
+    const int slot)
+{
+    __local int s[SCAN_BLOCK];
+    const int l = get_local_id(0);
+    int carry = 0;
+    for (int base = 0; base < num_blocks; base += SCAN_BLOCK) {
+        const int i = base + l;
+        s[l] = i < num_blocks ? blocks[i] : 0;
+        s[l + SCAN_GROUP] =
+            i + SCAN_GROUP < num_blocks ? blocks[i + SCAN_GROUP] : 0;
+        const int sum = scan_block(s);
+        if (i < num_blocks) blocks[i] = carry + s[l];
+        if (i + SCAN_GROUP < num_blocks) {
+            blocks[i + SCAN_GROUP] = carry + s[l + SCAN_GROUP];
+        }
+        carry += sum;
     }
+    if (l == 0) count[slot] = carry;
 }
 
+// survivors are packed in order of windows, boxes keep their scale in b[2].
+// Survivors past `cap` boxes are dropped.
 __kernel void detector_early_bbs(
-    const int out_w, const float casc_thr,
-    const int bbs_off, const int sum_off, const int off,
+    const int num_scales, const float casc_thr, __constant scale_t* scales,
     __global float* out, __global int* idx,
-    __global float* bbs, __global int* sum)
+    __global float* bbs, __global int* blocks, const int cap)
 {
-    const int2 pos = { get_global_id(0), get_global_id(1) };
-    const int out_idx = off + pos.y*out_w + pos.x;
+    const int out_idx = get_global_id(0);
     const float h = out[out_idx]; if (h <= casc_thr) return;
-    const int bbs_idx = bbs_off + (sum[sum_off + pos.y] + idx[out_idx])*5;
-    bbs[bbs_idx + 0] = pos.x; bbs[bbs_idx + 1] = pos.y;
-    bbs[bbs_idx + 4] = h;
+    const int k = find_scale(scales, num_scales, SCALE_OUT_OFF, out_idx);
+    __constant scale_t* s = scales + k;
+    const int j = out_idx - s->out_off;
+    const int box = blocks[out_idx / SCAN_BLOCK] + idx[out_idx];
+    const int bbs_idx = box*5; if (box >= cap) return;
+    bbs[bbs_idx + 0] = j % s->out_w; bbs[bbs_idx + 1] = j / s->out_w;
+    bbs[bbs_idx + 2] = k; bbs[bbs_idx + 4] = h;
+}
+
+// score `h` of window at `chns_off` continued by trees [first, last),
+// evaluated by a work-group in chunks of PREDICT_GROUP whose leaves are
+// scanned in `s`, so that the soft cascade stops at the same tree as a
+// serial sum and rejected windows skip remaining chunks.
+float cascade(
+    const int first,
+    const int last,
+    float h,
+    const int depth,
+    __global node_t* nodes,
+    __global float* chns,
+    const int chns_off,
+    const int row,
+    const int storage,
+    __local float* s,
+    __local int* stop)
+{
+    const int l = get_local_id(0);
+    for (int base = first; base < last; base += PREDICT_GROUP) {
+        const int t = base + l;
+        float v = 0.0f;
+        if (t < last) {
+            __global node_t* tree = nodes + t*TREE_NODES;
+            int k = 0;
+            for (int i = 0; i < DEPTH; ++i) {
+                k = k*2 + child(tree[k], chns, chns_off, row, storage);
+            }
+            v = tree[k].h;
+        }
+        // inclusive scan of leaves of the chunk
+        s[l] = v;
+        if (l == 0) *stop = PREDICT_GROUP;
+        for (int d = 1; d < PREDICT_GROUP; d <<= 1) {
+            barrier(CLK_LOCAL_MEM_FENCE);
+            v = l >= d ? s[l - d] : 0.0f;
+            barrier(CLK_LOCAL_MEM_FENCE);
+            s[l] += v;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        // the first tree is always summed, as by the serial loop
+        if (t >= 1 && t < last && h + s[l] <= -1) atomic_min(stop, l);
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (*stop < PREDICT_GROUP) {
+            h += s[*stop];
+            break;
+        }
+        h += s[PREDICT_GROUP - 1];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    return h;
 }
 
-__kernel void detector_predict(
-    const int num_weaks,
+// a stage of trees [first, last) on boxes counted by `count[slot]`, scores
+// of boxes are continued past the first stage. Persistent work-groups pull
+// boxes from `queue` until it drains, so that windows which survive many
+// trees are balanced over compute units dynamically. Boxes past `cap` are
+// never pulled.
+__kernel __attribute__((reqd_work_group_size(PREDICT_GROUP, 1, 1)))
+void detector_predict(
+    const int first,
+    const int last,
     const int depth,
     const int to_org,
-    const int org_w,
+    __constant scale_t* scales,
     const float casc_thr,
-    const int bbs_off,
-    const int hss_off,
-    __global float* thrs,
-    __global float* hs,
-    __global int* fids,
+    __global node_t* nodes,
     __global float* chns,
-    __global int* cids,
     __global float* bbs,
-    __global float* hss)
+    const int cell,
+    const int storage,
+    __global int* count,
+    const int slot,
+    const int cap,
+    __global int* queue)
 {
-    __global float* b = bbs + bbs_off + get_global_id(0)*5;
-    __global float* h = hss + hss_off + get_global_id(0)*num_weaks;
-    const int2 pos = { b[0], b[1] };
-    const int2 org_pos = pos*to_org;
-    const int chns_off = (org_pos.y*org_w + org_pos.x)*16;
-    const int t = get_global_id(1);
-    const int off = t*TREE_NODES;
-    int k = off, k0 = 0;
-    for (int i = 0; i < depth; ++i) {
-        get_child(
-            thrs, fids, chns + chns_off,
-            cids, off, &k0, &k);
+    __local float s[PREDICT_GROUP];
+    __local int stop;
+    __local int next;
+    const int l = get_local_id(0);
+    const int n = min(count[slot], cap);
+    for (;;) {
+        if (l == 0) next = atomic_inc(queue);
+        barrier(CLK_LOCAL_MEM_FENCE);
+        const int i = next;
+        if (i >= n) break;
+        __global float* b = bbs + i*5;
+        __constant scale_t* sc = scales + (int)b[2];
+        const int2 pos = { b[0], b[1] };
+        const int2 org_pos = pos*to_org;
+        const int chns_off =
+            sc->chns_off + (org_pos.y*sc->org_w + org_pos.x)*cell;
+        const float h = cascade(
+            first, last, first > 0 ? b[4] : 0.0f, depth, nodes, chns,
+            chns_off, sc->org_w*cell, storage, s, &stop);
+        if (l == 0) b[4] = h;
+        // `next` and `s` are reused by the next box
+        barrier(CLK_LOCAL_MEM_FENCE);
     }
-    h[t] = hs[k];
 }
 
-__kernel void detector_predict_sum(
-    const int num_weaks, const float casc_thr,
-    __global float* hss, __global float* bss)
+// boxes of `count[slot]` which were not rejected by the soft cascade.
+__kernel void detector_stage_flags(
+    __global float* bbs, __global int* count, const int slot,
+    const int cap, __global int* flags)
 {
-    __global float* h = hss + get_global_id(0)*num_weaks;
-    __global float* b = bss + get_global_id(0)*5; b[4] = h[0];
-    for (int i = 1; i < num_weaks; ++i) {
-        b[4] += h[i]; if (b[4] <= -1) break;
-    }
-}
\ No newline at end of file
+    const int i = get_global_id(0);
+    flags[i] = i < min(count[slot], cap) && bbs[i*5 + 4] > -1;
+}
+
+// packs flagged boxes of `src` into `dst` in order.
+__kernel void detector_stage_bbs(
+    __global float* src, __global int* flags, __global int* idx,
+    __global int* blocks, __global float* dst)
+{
+    const int i = get_global_id(0); if (!flags[i]) return;
+    __global float* s = src + i*5;
+    __global float* d = dst + (blocks[i / SCAN_BLOCK] + idx[i])*5;
+    d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; d[3] = s[3]; d[4] = s[4];
+}
@@ -13,13 +13,31 @@ int pixel_idx(const int w, const int2 pos)
     return pos.y*w + pos.x;
 }
 
-__kernel void grad_mag32fc4(
-    __global float4* img, const int2 sz,
-	__global float* mag, __global float* angle)
+// same as in resample.cl, compact feature cells take 6 orientations only.
+void vstore8_view(const float8 v, const int4 view, __global float* p)
+{
+    if (view.s2 - view.s3 >= 8) {
+        vstore8(v, 0, p);
+    } else {
+        vstore4(v.s0123, 0, p);
+        vstore2(v.s45, 0, p + 4);
+    }
+}
+
+// specialized variants of grad_hist are built with -DBIN_SIZE and
+// -DNUM_ORIENTS, runtime arguments are ignored then.
+#ifndef BIN_SIZE
+#define BIN_SIZE bin_size
+#endif
+#ifndef NUM_ORIENTS
+#define NUM_ORIENTS num_orients
+#endif
+
+// gradient of the channel with max magnitude, returns squared magnitude.
+float grad32fc4(
+    __global float4* img, const int x, const int y, const int2 sz,
+    float* gx, float* gy)
 {
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int idx = pixel_idx(sz.s0, (int2)(x, y));
     const float4 l = img[pixel_idx(sz.s0, border(x - 1, y, sz))];
     const float4 r = img[pixel_idx(sz.s0, border(x + 1, y, sz))];
     const float4 t = img[pixel_idx(sz.s0, border(x, y - 1, sz))];
@@ -41,9 +59,42 @@ __kernel void grad_mag32fc4(
     };
     int max_idx = mag2[0] > mag2[1] ? 0 : 1;
     max_idx = mag2[max_idx] > mag2[2] ? max_idx : 2;
-    mag[idx] = native_sqrt(mag2[max_idx]);
-    const float o = mag[idx] == 0 ? 0 : atan2(dy[max_idx], dx[max_idx]);
-    angle[idx] = o < 0 ? M_PI_F + o : o;
+    *gx = dx[max_idx];
+    *gy = dy[max_idx];
+    return mag2[max_idx];
+}
+
+// angle in [0, pi) of non zero gradient.
+float grad_angle(const float m, const float gx, const float gy)
+{
+    const float o = m == 0 ? 0 : atan2(gy, gx);
+    return o < 0 ? M_PI_F + o : o;
+}
+
+// angle in [0, pi) from acos table of `lut_size` entries over [-1, 1],
+// acos(-x) = pi - acos(x) folds negative dy into the same table.
+float grad_angle_lut(
+    __constant float* lut, const int lut_size,
+    const float mag2, const float gx, const float gy)
+{
+    if (mag2 == 0) return 0;
+    const float c = (gy < 0 ? -gx : gx)*native_rsqrt(mag2);
+    const int i = (int)((c + 1.0f)*0.5f*(lut_size - 1) + 0.5f);
+    return lut[clamp(i, 0, lut_size - 1)];
+}
+
+// angle is optional, fused grad_norm_hist32fc4 doesn't need it.
+__kernel void grad_mag32fc4(
+    __global float4* img, const int2 sz,
+	__global float* mag, __global float* angle)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const int idx = pixel_idx(sz.s0, (int2)(x, y));
+    float gx, gy;
+    const float m = native_sqrt(grad32fc4(img, x, y, sz, &gx, &gy));
+    mag[idx] = m;
+    if (angle) angle[idx] = grad_angle(m, gx, gy);
 }
 
 __kernel void grad_mag_norm(
@@ -70,21 +121,21 @@ __kernel void grad_hist(
     const int2 sz, const int bin_size, const int num_orients)
 {
     const int2 pos = { get_global_id(0), get_global_id(1) };
-    const int2 sz0 = sz*bin_size;
-    const int2 pos0 = pos*bin_size;
-    const float nrm = 1.0f / (bin_size*bin_size);
+    const int2 sz0 = sz*BIN_SIZE;
+    const int2 pos0 = pos*BIN_SIZE;
+    const float nrm = 1.0f / (BIN_SIZE*BIN_SIZE);
     float h[8] = {
         0.0f, 0.0f, 0.0f, 0.0f,
         0.0f, 0.0f, 0.0f, 0.0f
     };
-    for (int y = 0; y < bin_size; ++y) {
-        for (int x = 0; x < bin_size; ++x) {
+    for (int y = 0; y < BIN_SIZE; ++y) {
+        for (int x = 0; x < BIN_SIZE; ++x) {
             const int idx = pixel_idx(sz0.s0, pos0 + (int2)(x, y));
             const float o = angle[idx];
             const int io0 = (int)o;
             const float od = o - io0;
-            const int o0 = io0 % num_orients;
-            const int o1 = (o0 + 1) % num_orients;
+            const int o0 = io0 % NUM_ORIENTS;
+            const int o1 = (o0 + 1) % NUM_ORIENTS;
             const float m = mag[idx]*nrm;
             const float m1 = od*m;
             h[o0] += m - m1;
@@ -96,3 +147,51 @@ __kernel void grad_hist(
         h[4], h[5], h[6], h[7]
     );
 }
+
+// grad_mag_norm, grad_scale_angle and grad_hist in one pass, angles are
+// recomputed from `img` instead of being stored. `mag` holds unnormalized
+// magnitude and is normalized in place. Angles are looked up in `acos_lut`
+// unless `lut_size` is 0.
+__kernel void grad_norm_hist32fc4(
+    __global float* hist, const int4 hist_view, __global float4* img,
+    __global float* mag, __global float* nrm,
+    const int2 sz, const float nrm_const, const float scale,
+    const int bin_size, const int num_orients,
+    __constant float* acos_lut, const int lut_size)
+{
+    const int2 pos = { get_global_id(0), get_global_id(1) };
+    const int2 sz0 = sz*BIN_SIZE;
+    const int2 pos0 = pos*BIN_SIZE;
+    const float nrm_cell = 1.0f / (BIN_SIZE*BIN_SIZE);
+    float h[8] = {
+        0.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 0.0f
+    };
+    for (int y = 0; y < BIN_SIZE; ++y) {
+        for (int x = 0; x < BIN_SIZE; ++x) {
+            const int2 p = pos0 + (int2)(x, y);
+            const int idx = pixel_idx(sz0.s0, p);
+            float gx, gy;
+            const float mag2 = grad32fc4(img, p.x, p.y, sz0, &gx, &gy);
+            const float mn = mag[idx] / (nrm[idx] + nrm_const);
+            mag[idx] = mn;
+            const float o = scale*(lut_size > 0 ?
+                grad_angle_lut(acos_lut, lut_size, mag2, gx, gy) :
+                grad_angle(mn, gx, gy));
+            const int io0 = (int)o;
+            const float od = o - io0;
+            const int o0 = io0 % NUM_ORIENTS;
+            const int o1 = (o0 + 1) % NUM_ORIENTS;
+            const float m = mn*nrm_cell;
+            const float m1 = od*m;
+            h[o0] += m - m1;
+            h[o1] += m1;
+        }
+    }
+    // destination view, see resample.cl
+    vstore8_view((float8)(
+        h[0], h[1], h[2], h[3],
+        h[4], h[5], h[6], h[7]
+    ), hist_view, hist + (hist_view.s1 + pos.y*hist_view.s0 + pos.x)*
+        hist_view.s2 + hist_view.s3);
+}
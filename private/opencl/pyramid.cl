@@ -5,23 +5,227 @@ int pixel_idx(const int w, const int2 pos)
     return pos.y*w + pos.x;
 }
 
-__kernel void pyramid_conpad(
-    __global float16* dst,
-    int2 sz, int2 pad,
-    __global float4* color,
-    __global float* mag,
-    __global float8* hist)
+int border1(const int x, const int n)
 {
+    // symmetric padding
+    return x < 0 ? -x : (x < n ? x : (2*n - x - 2));
+}
+
+// specialized variants are built with -DPAD_W and -DPAD_H,
+// runtime `pad` argument is ignored then.
+#if defined(PAD_W) && defined(PAD_H)
+#define PAD ((int2)(PAD_W, PAD_H))
+#else
+#define PAD pad
+#endif
+
+// compact variants are built with -DCOMPACT, cells hold LUV, magnitude and
+// 6 orientations in 10 floats, instead of LUV at s0-s2, magnitude at s4 and
+// orientations from s8. Cells are loaded into float16 either way.
+#ifdef COMPACT
+#define CELL 10
+#else
+#define CELL 16
+#endif
+
+// half variants are built with -DHALF, pyramid slots are stored as half
+// floats by vstore_half, the arithmetic is float, cl_khr_fp16 is not needed.
+// U8 variants are built with -DU8, slots are bytes of features quantized by
+// runtime `quant` of color, magnitude and histogram channels.
+#if defined(HALF)
+#define SLOT_T half
+#define PACKED
+#elif defined(U8)
+#define SLOT_T uchar
+#define PACKED
+#else
+#define SLOT_T float
+#endif
+
+// bytes per unit of each channel, 1 for lanes always zero.
+float16 lane_quant(const float4 quant)
+{
+    float16 q = (float16)1.0f;
+    q.s012 = quant.s012;
+#ifdef COMPACT
+    q.s3 = quant.s1;
+    q.s456789 = quant.s2;
+#else
+    q.s4 = quant.s1;
+    q.s89abcdef = quant.s2;
+#endif
+    return q;
+}
+
+float16 load_cell(const int idx, __global float* p)
+{
+#ifdef COMPACT
+    float16 v = (float16)0.0f;
+    v.s01234567 = vload8(0, p + idx*CELL);
+    v.s89 = vload2(4, p + idx*CELL);
+    return v;
+#else
+    return vload16(idx, p);
+#endif
+}
+
+void store_cell(const float16 v, const int idx, __global float* p)
+{
+#ifdef COMPACT
+    vstore8(v.s01234567, 0, p + idx*CELL);
+    vstore2(v.s89, 4, p + idx*CELL);
+#else
+    vstore16(v, idx, p);
+#endif
+}
+
+float16 load_slot(const int idx, __global SLOT_T* p, const float16 q)
+{
+#if defined(HALF) && defined(COMPACT)
+    float16 v = (float16)0.0f;
+    v.s01234567 = vload_half8(0, p + idx*CELL);
+    v.s89 = vload_half2(4, p + idx*CELL);
+    return v;
+#elif defined(HALF)
+    return vload_half16(idx, p);
+#elif defined(U8) && defined(COMPACT)
+    float16 v = (float16)0.0f;
+    v.s01234567 = convert_float8(vload8(0, p + idx*CELL));
+    v.s89 = convert_float2(vload2(4, p + idx*CELL));
+    return v / q;
+#elif defined(U8)
+    return convert_float16(vload16(idx, p)) / q;
+#else
+    return load_cell(idx, p);
+#endif
+}
+
+void store_slot(
+    const float16 v, const int idx, __global SLOT_T* p, const float16 q)
+{
+#if defined(HALF) && defined(COMPACT)
+    vstore_half8(v.s01234567, 0, p + idx*CELL);
+    vstore_half2(v.s89, 4, p + idx*CELL);
+#elif defined(HALF)
+    vstore_half16(v, idx, p);
+#elif defined(U8) && defined(COMPACT)
+    const float16 b = v*q;
+    vstore8(convert_uchar8_sat_rte(b.s01234567), 0, p + idx*CELL);
+    vstore2(convert_uchar2_sat_rte(b.s89), 4, p + idx*CELL);
+#elif defined(U8)
+    vstore16(convert_uchar16_sat_rte(v*q), idx, p);
+#else
+    store_cell(v, idx, p);
+#endif
+}
+
+// fills border of padded features, color is replicated from the nearest
+// pixel inside while other channels are zero. Pixels inside are written by
+// channel kernels into `src`, which is `dst` itself unless slots are packed
+// (half or bytes), they are converted then.
+__kernel void pyramid_border(
+    __global SLOT_T* dst, int2 sz, int2 pad, __global float* src,
+    const float4 quant)
+{
+    const float16 q = lane_quant(quant);
+    const int2 dst_pos = { get_global_id(0), get_global_id(1) };
+    const int2 org_pos = dst_pos - PAD;
+    const int2 nrm_pos = clamp(org_pos, (int2)0, sz - (int2)1);
+    const int w = sz.s0 + 2*PAD.s0;
+    const int inside = pixel_idx(w, nrm_pos + PAD);
+    float16 out = (float16)0.0f;
+    if (nrm_pos.s0 == org_pos.s0 && nrm_pos.s1 == org_pos.s1) {
+#ifdef PACKED
+        store_slot(load_cell(inside, src), inside, dst, q);
+#endif
+        return;
+    }
+    out.s012 = vload3(0, src + inside*CELL);
+    store_slot(out, pixel_idx(w, dst_pos), dst, q);
+}
+
+typedef struct level_s {
+    float4 ratio; // color, magnitude, histogram power law ratio
+    int2 sz; // data size
+    int2 src_sz; // data size of real scale
+} level_t;
+
+// padded features of approximated levels `first + z`, resampled from
+// padded features of real scale (not smoothed yet) into `dst{z}` directly.
+__kernel void pyramid_approx(
+    __global SLOT_T* dst0, __global SLOT_T* dst1,
+    __global SLOT_T* dst2, __global SLOT_T* dst3,
+    __global SLOT_T* dst4, __global SLOT_T* dst5,
+    __global SLOT_T* dst6, __global SLOT_T* dst7,
+    int2 pad, __constant level_t* levels, const int first,
+    __global float* src, const float4 quant)
+{
+    const int z = get_global_id(2);
+    const level_t lv = levels[first + z];
+    const int2 sz = lv.sz;
     const int2 dst_pos = { get_global_id(0), get_global_id(1) };
-    const int2 org_pos = dst_pos - pad;
+    if (dst_pos.s0 >= sz.s0 + 2*PAD.s0 || dst_pos.s1 >= sz.s1 + 2*PAD.s1) {
+        return; // smaller than largest level of this launch
+    }
+    __global SLOT_T* dst =
+        z == 0 ? dst0 : z == 1 ? dst1 : z == 2 ? dst2 : z == 3 ? dst3 :
+        z == 4 ? dst4 : z == 5 ? dst5 : z == 6 ? dst6 : dst7;
+    const int2 org_pos = dst_pos - PAD;
     const int2 nrm_pos = clamp(org_pos, (int2)0.0f, sz - (int2)1.0f);
-    const int dst_idx = pixel_idx(sz.s0 + 2*pad.s0, dst_pos);
-    const int nrm_idx = pixel_idx(sz.s0, nrm_pos);
+    const int dst_idx = pixel_idx(sz.s0 + 2*PAD.s0, dst_pos);
+    // bilinear resample, same as resample kernels
+    const float gx = nrm_pos.s0 / (float)sz.s0 * (lv.src_sz.s0 - 1);
+    const float gy = nrm_pos.s1 / (float)sz.s1 * (lv.src_sz.s1 - 1);
+    const int gxi = (int)gx;
+    const int gyi = (int)gy;
+    const float tx = gx - gxi;
+    const float ty = gy - gyi;
+    const int src_w = lv.src_sz.s0 + 2*PAD.s0;
+    const int i00 = pixel_idx(src_w, (int2)(gxi, gyi) + PAD);
+    const int i01 = i00 + src_w;
+    const float16 c = mix(
+        mix(load_cell(i00, src), load_cell(i00 + 1, src), tx),
+        mix(load_cell(i01, src), load_cell(i01 + 1, src), tx), ty);
     float16 out = (float16)0.0f;
-    out.s0123 = color[nrm_idx];
+    out.s012 = c.s012*lv.ratio.s0;
     if (nrm_pos.s0 == org_pos.s0 && nrm_pos.s1 == org_pos.s1) {
-        out.s4 = mag[nrm_idx];
-        out.s89abcdef = hist[nrm_idx];
+#ifdef COMPACT
+        out.s3 = c.s3*lv.ratio.s1;
+        out.s456789 = c.s456789*lv.ratio.s2;
+#else
+        out.s4 = c.s4*lv.ratio.s1;
+        out.s89abcdef = c.s89abcdef*lv.ratio.s2;
+#endif
     }
-    dst[dst_idx] = out;
-}
\ No newline at end of file
+    store_slot(out, dst_idx, dst, lane_quant(quant));
+}
+
+// triangle filter of slots of padded size `sz` along columns into float
+// cells `tmp`, then along rows back, for slots the convolution kernels
+// can't take (packed).
+__kernel void pyramid_smooth_cols(
+    __global float* tmp, const int2 sz, const int r,
+    __constant float* filter, __global SLOT_T* src, const float4 quant)
+{
+    const int2 pos = { get_global_id(0), get_global_id(1) };
+    const float16 q = lane_quant(quant);
+    float16 sum = (float16)0.0f;
+    for (int i = -r; i <= r; ++i) {
+        const int2 p = { pos.x, border1(pos.y + i, sz.s1) };
+        sum += load_slot(pixel_idx(sz.s0, p), src, q)*filter[i + r];
+    }
+    store_cell(sum, pixel_idx(sz.s0, pos), tmp);
+}
+
+__kernel void pyramid_smooth_rows(
+    __global SLOT_T* dst, const int2 sz, const int r,
+    __constant float* filter, __global float* tmp, const float4 quant)
+{
+    const int2 pos = { get_global_id(0), get_global_id(1) };
+    float16 sum = (float16)0.0f;
+    for (int i = -r; i <= r; ++i) {
+        const int2 p = { border1(pos.x + i, sz.s0), pos.y };
+        sum += load_cell(pixel_idx(sz.s0, p), tmp)*filter[i + r];
+    }
+    store_slot(sum, pixel_idx(sz.s0, pos), dst, lane_quant(quant));
+}
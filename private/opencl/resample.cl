@@ -5,8 +5,26 @@ int pixel_idx(const int w, const int x, const int y)
     return y*w + x;
 }
 
+// index of first float of pixel in destination view, which is row pitch
+// and offset in cells, floats per cell and lane of pixel in cell.
+int view_idx(const int4 view, const int x, const int y)
+{
+    return (view.s1 + y*view.s0 + x)*view.s2 + view.s3;
+}
+
+// 8 floats into view, compact feature cells have room for 6 orientations.
+void vstore8_view(const float8 v, const int4 view, __global float* p)
+{
+    if (view.s2 - view.s3 >= 8) {
+        vstore8(v, 0, p);
+    } else {
+        vstore4(v.s0123, 0, p);
+        vstore2(v.s45, 0, p + 4);
+    }
+}
+
 __kernel void resample32f(
-    __global float* dst, int2 dst_sz,
+    __global float* dst, int2 dst_sz, int4 view,
 	__global float* src, int2 src_sz, float norm)
 {
     const int x = get_global_id(0);
@@ -21,12 +39,12 @@ __kernel void resample32f(
     const float c11 = src[pixel_idx(src_sz.s0, gxi + 1, gyi + 1)];
     const float tx = gx - gxi;
     const float ty = gy - gyi;
-    dst[pixel_idx(dst_sz.s0, x, y)] =
+    dst[view_idx(view, x, y)] =
         mix(mix(c00, c10, tx), mix(c01, c11, tx), ty)*norm;
 }
 
 __kernel void resample32fc4(
-    __global float4* dst, int2 dst_sz,
+    __global float* dst, int2 dst_sz, int4 view,
 	__global float4* src, int2 src_sz, float norm)
 {
     const int x = get_global_id(0);
@@ -41,12 +59,13 @@ __kernel void resample32fc4(
     const float4 c11 = src[pixel_idx(src_sz.s0, gxi + 1, gyi + 1)];
     const float tx = gx - gxi;
     const float ty = gy - gyi;
-    dst[pixel_idx(dst_sz.s0, x, y)] =
-        mix(mix(c00, c10, tx), mix(c01, c11, tx), ty)*norm;
+    vstore4(
+        mix(mix(c00, c10, tx), mix(c01, c11, tx), ty)*norm,
+        0, dst + view_idx(view, x, y));
 }
 
 __kernel void resample32fc8(
-    __global float8* dst, int2 dst_sz,
+    __global float* dst, int2 dst_sz, int4 view,
 	__global float8* src, int2 src_sz, float norm)
 {
     const int x = get_global_id(0);
@@ -61,6 +80,32 @@ __kernel void resample32fc8(
     const float8 c11 = src[pixel_idx(src_sz.s0, gxi + 1, gyi + 1)];
     const float tx = gx - gxi;
     const float ty = gy - gyi;
+    vstore8_view(
+        mix(mix(c00, c10, tx), mix(c01, c11, tx), ty)*norm,
+        view, dst + view_idx(view, x, y));
+}
+
+// pixel centers aligned, so that exact 2x is average of 2x2 source pixels.
+__kernel void downsample32fc4(
+    __global float4* dst, int2 dst_sz,
+	__global float4* src, int2 src_sz)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const float gx = clamp(
+        (x + 0.5f)*src_sz.s0 / dst_sz.s0 - 0.5f, 0.0f, src_sz.s0 - 1.0f);
+    const float gy = clamp(
+        (y + 0.5f)*src_sz.s1 / dst_sz.s1 - 0.5f, 0.0f, src_sz.s1 - 1.0f);
+    const int gxi = (int)gx;
+    const int gyi = (int)gy;
+    const int gxi1 = min(gxi + 1, src_sz.s0 - 1);
+    const int gyi1 = min(gyi + 1, src_sz.s1 - 1);
+    const float4 c00 = src[pixel_idx(src_sz.s0, gxi, gyi)];
+    const float4 c10 = src[pixel_idx(src_sz.s0, gxi1, gyi)];
+    const float4 c01 = src[pixel_idx(src_sz.s0, gxi, gyi1)];
+    const float4 c11 = src[pixel_idx(src_sz.s0, gxi1, gyi1)];
+    const float tx = gx - gxi;
+    const float ty = gy - gyi;
     dst[pixel_idx(dst_sz.s0, x, y)] =
-        mix(mix(c00, c10, tx), mix(c01, c11, tx), ty)*norm;
+        mix(mix(c00, c10, tx), mix(c01, c11, tx), ty);
 }
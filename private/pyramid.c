@@ -4,10 +4,74 @@
 #include <yapd/gpu.h>
 #include <yapd/buffer.h>
 #include <yapd/channels.h>
+#include <cpu/cpu.h>
 #include <pyramid.cl.h>
 
+#include <stdio.h>
+
 enum { APX_REAL = -1 };
 
+// kernels of pyramid.cl specialized by conpad_kernel().
+enum {
+    CONPAD_BORDER,
+    CONPAD_APPROX,
+    CONPAD_SMOOTH_COLS,
+    CONPAD_SMOOTH_ROWS
+};
+
+// bytes of a feature cell in pyramid slots.
+static int
+cell_bytes(
+    const yapd_pyramid_t* p)
+{
+    switch (p->opts.storage) {
+    case YAPD_FEATURE_HALF: return p->cell*(int)sizeof(cl_half);
+    case YAPD_FEATURE_U8: return p->cell*(int)sizeof(cl_uchar);
+    default: return p->cell*(int)sizeof(float);
+    }
+}
+
+// quantization scale of each lane of pyramid cells, same as lane_quant()
+// of pyramid.cl.
+static void
+lane_quant(
+    const yapd_pyramid_t* p, float* q)
+{
+    int i;
+    const int mag = p->opts.compact ? 3 : 4;
+    const int hist = p->opts.compact ? 4 : 8;
+    for (i = 0; i < p->cell; ++i) {
+        q[i] = i < 3 ? p->opts.quant[0] : 1.0f;
+    }
+    q[mag] = p->opts.quant[1];
+    for (i = hist; i < p->cell; ++i) {
+        q[i] = p->opts.quant[2];
+    }
+}
+
+// converts float cells of `src` into slot `dst` as p->opts.storage.
+static void
+pack_cpu(
+    yapd_pyramid_t* p, yapd_buffer_t* dst, const float* src, int n)
+{
+    float q[YAPD_FEATURE_CHANNELS];
+    lane_quant(p, q);
+    yapd_cpu_pyramid_pack(
+        p->gpu, dst->host, p->opts.storage, src, p->cell, q, n);
+}
+
+static void
+set_quant(
+    const yapd_pyramid_t* p, cl_kernel k, int arg)
+{
+    cl_int err;
+    const cl_float4 quant = {
+        { p->opts.quant[0], p->opts.quant[1], p->opts.quant[2], 1.0f }
+    };
+    err = clSetKernelArg(k, arg, sizeof(cl_float4), &quant);
+    assert(err == CL_SUCCESS);
+}
+
 static void
 get_scales(
     yapd_pyramid_t* p, int w, int h)
@@ -66,6 +130,15 @@ get_scales(
         p->a.dealloc(p->aud, p->data_sz);
         p->data_sz = (yapd_size_t*)p->a.alloc(
             p->aud, sizeof(yapd_size_t)*p->num_scales, YAPD_DEFAULT_ALIGN);
+
+        p->a.dealloc(p->aud, p->slot_off);
+        p->slot_off = (int*)p->a.alloc(
+            p->aud, sizeof(int)*p->num_scales, YAPD_DEFAULT_ALIGN);
+
+        p->a.dealloc(p->aud, p->levels_host);
+        p->levels_host = (yapd_pyramid_level_t*)p->a.alloc(
+            p->aud, sizeof(yapd_pyramid_level_t)*p->num_scales,
+            YAPD_DEFAULT_ALIGN);
         for (i = 0; i < p->cap_scales; ++i) {
             yapd_buffer_release(p->data + i);
         }
@@ -116,7 +189,7 @@ get_scales(
     // bubble sort
     while (TRUE) {
         int done = TRUE;
-        for (i = p->num_scales; i > 0; --i) {
+        for (i = p->num_scales - 1; i > 0; --i) {
             if (p->scales[i - 1] < p->scales[i]) {
                 const float tmp = p->scales[i];
                 p->scales[i] = p->scales[i - 1];
@@ -156,78 +229,345 @@ reserve_buffers(
     assert(w > 0 && h > 0);
     yapd_buffer_reserve(&p->tmp, sizeof(cl_float4)*w*h*3);
     yapd_buffer_reserve(&p->img, sizeof(cl_float4)*w*h*3);
-    yapd_buffer_reserve(&p->small, sizeof(cl_float4)*w*h*3);
+    yapd_buffer_reserve(&p->rgb, sizeof(cl_uchar4)*w*h);
 }
 
+// channels of real scale `i`, written inside its padded features slot,
+// `next` is the next real scale or -1.
 static void
 compute_real(
-    yapd_pyramid_t* p, const yapd_size_t* sz, float s)
+    yapd_pyramid_t* p, const yapd_size_t* sz, int i, int next)
 {
-    yapd_size_t small_sz;
-    yapd_buffer_t *small;
+    yapd_buffer_t swap;
+    yapd_size_t small_sz, next_sz;
+    yapd_channels_out_t out;
     const int shrink = p->channels->opts.shrink;
-    small_sz.w = ((int)rintf(sz->w*s / shrink))*shrink;
-    small_sz.h = ((int)rintf(sz->h*s / shrink))*shrink;
-    if (yapd_size_equals(&small_sz, sz)) {
-        small = &p->img;
+    const int pitch = p->data_sz[i].w + (p->opts.pad.w / shrink) * 2;
+    small_sz.w = p->data_sz[i].w*shrink;
+    small_sz.h = p->data_sz[i].h*shrink;
+    // packed slots are converted from float cells of `work` by border()
+    out.color.buf =
+        p->opts.storage != YAPD_FEATURE_FLOAT ? &p->work : p->data + i;
+    out.color.pitch = pitch;
+    out.color.offset =
+        (p->opts.pad.h / shrink)*pitch + p->opts.pad.w / shrink;
+    out.color.cell = p->cell;
+    out.color.lane = 0;
+    out.mag = out.color;
+    out.hist = out.color;
+    if (p->opts.compact) {
+        // zero 4th float of color is overwritten by magnitude later
+        out.mag.lane = 3;
+        out.hist.lane = 4;
     } else {
-        small = &p->small;
-        yapd_buffer_resample32fc4(small, &small_sz, &p->img, sz, 1.0f);
+        out.mag.lane = 4;
+        out.hist.lane = 8;
+    }
+    yapd_channels_prepare(p->channels, &small_sz, NULL, NULL, NULL);
+    if (!p->opts.cascade) {
+        // LUV is computed from source pixels for each real scale
+        yapd_channels_compute_rgb8uc4_view(
+            p->channels, &p->rgb, sz, &p->img, &p->tmp, &out);
+        return;
+    }
+    // unsmoothed LUV of first real scale from source pixels, the others
+    // are downsampled from previous one into `img` before it's smoothed
+    if (i == 0) {
+        yapd_buffer_reserve(
+            &p->img, sizeof(cl_float4)*small_sz.w*small_sz.h);
+        yapd_buffer_reserve(
+            &p->tmp, sizeof(cl_float4)*small_sz.w*small_sz.h);
+        yapd_buffer_luv_smooth_rgb8uc4(
+            &p->img, &p->tmp, &small_sz, &p->rgb, sz, 0, &p->smooth_filter);
     }
-    yapd_channels_prepare(
-        p->channels, &small_sz, &p->color, &p->mag, &p->hist);
-    yapd_channels_compute(
-        p->channels, small, &p->tmp, &p->color, &p->mag, &p->hist);
+    if (next >= 0) {
+        next_sz.w = p->data_sz[next].w*shrink;
+        next_sz.h = p->data_sz[next].h*shrink;
+        yapd_buffer_reserve(
+            &p->base, sizeof(cl_float4)*next_sz.w*next_sz.h);
+        yapd_buffer_downsample32fc4(&p->base, &next_sz, &p->img, &small_sz);
+    }
+    yapd_channels_compute_view(p->channels, &p->img, &p->tmp, &out);
+    swap = p->img;
+    p->img = p->base;
+    p->base = swap;
 }
 
+static cl_kernel
+conpad_pick(
+    const yapd_gpu_conpad_variant_t* v, int kernel)
+{
+    switch (kernel) {
+    case CONPAD_BORDER: return v->pyramid_border;
+    case CONPAD_APPROX: return v->pyramid_approx;
+    case CONPAD_SMOOTH_COLS: return v->pyramid_smooth_cols;
+    default: return v->pyramid_smooth_rows;
+    }
+}
+
+// `kernel` of pyramid.cl specialized for given padding, feature layout and
+// storage of slots.
+static cl_kernel
+conpad_kernel(
+    yapd_gpu_t* gpu, const yapd_size_t* pad, int compact, int storage,
+    int kernel)
+{
+    int i;
+    cl_int err;
+    char options[64];
+    yapd_gpu_conpad_variant_t* v;
+    yapd_gpu_pyramid_ctx_t* c = &gpu->pyramid;
+    for (i = 0; i < c->num_variants; ++i) {
+        v = c->variants + i;
+        if (yapd_size_equals(&v->pad, pad) &&
+            v->compact == compact && v->storage == storage) {
+            return conpad_pick(v, kernel);
+        }
+    }
+    if (c->num_variants == YAPD_GPU_MAX_VARIANTS) {
+        // generic kernels are built for float16 cells of float slots only
+        assert(!compact && storage == YAPD_FEATURE_FLOAT);
+        assert(kernel == CONPAD_BORDER || kernel == CONPAD_APPROX);
+        return kernel == CONPAD_APPROX ? c->pyramid_approx : c->pyramid_border;
+    }
+    v = c->variants + c->num_variants++;
+    v->pad = *pad;
+    v->compact = compact;
+    v->storage = storage;
+    snprintf(
+        options, sizeof(options), "-DPAD_W=%d -DPAD_H=%d%s%s",
+        pad->w, pad->h, compact ? " -DCOMPACT" : "",
+        storage == YAPD_FEATURE_HALF ? " -DHALF" :
+        storage == YAPD_FEATURE_U8 ? " -DU8" : "");
+    v->program = yapd_gpu_load_program(gpu, pyramid_cl, options);
+    v->pyramid_border = clCreateKernel(v->program, "pyramid_border", &err);
+    assert(err == CL_SUCCESS);
+    v->pyramid_approx = clCreateKernel(v->program, "pyramid_approx", &err);
+    assert(err == CL_SUCCESS);
+    v->pyramid_smooth_cols =
+        clCreateKernel(v->program, "pyramid_smooth_cols", &err);
+    assert(err == CL_SUCCESS);
+    v->pyramid_smooth_rows =
+        clCreateKernel(v->program, "pyramid_smooth_rows", &err);
+    assert(err == CL_SUCCESS);
+    return conpad_pick(v, kernel);
+}
+
+// border of padded features at scale `i`, inside is already written, into
+// `work` if slots are packed, it's converted into the slot then.
 static void
-conpad(
-    yapd_buffer_t* dst, const yapd_size_t* sz, const yapd_size_t* pad_sz,
-    yapd_buffer_t* color, yapd_buffer_t* mag, yapd_buffer_t* hist)
+border(
+    yapd_pyramid_t* p, int i)
 {
     cl_int err;
-    yapd_gpu_t* gpu = dst->gpu;
-    size_t offset[] = { 0, 0, 0 };
-    size_t size[] = { pad_sz->w, pad_sz->h, 1 };
+    cl_kernel k;
+    yapd_gpu_t* gpu = p->gpu;
+    yapd_buffer_t* dst = p->data + i;
+    const int storage = p->opts.storage;
+    const int packed = storage != YAPD_FEATURE_FLOAT;
+    yapd_buffer_t* src = packed ? &p->work : dst;
+    const yapd_size_t* sz = p->data_sz + i;
+    const int shrink = p->channels->opts.shrink;
     const yapd_size_t pad = {
-        (pad_sz->w - sz->w) / 2,
-        (pad_sz->h - sz->h) / 2
+        p->opts.pad.w / shrink,
+        p->opts.pad.h / shrink
     };
-    yapd_gpu_pyramid_ctx_t* c = &gpu->pyramid;
+    size_t offset[] = { 0, 0, 0 };
+    size_t size[] = { sz->w + 2*pad.w, sz->h + 2*pad.h, 1 };
 
-    YAPD_STATIC_ASSERT(sizeof(yapd_feature_t) == sizeof(cl_float16));
+    assert(dst->bytes >= (size_t)cell_bytes(p)*size[0]*size[1]);
+    assert(src->bytes >= sizeof(float)*p->cell*size[0]*size[1]);
+
+    if (pad.w == 0 && pad.h == 0 && !packed) return;
 
-    assert(gpu == color->gpu && gpu == mag->gpu && gpu == hist->gpu);
-    assert(dst->bytes >= sizeof(cl_float16)*pad_sz->w*pad_sz->h);
-    assert(color->bytes >= sizeof(cl_float4)*sz->w*sz->h);
-    assert(mag->bytes >= sizeof(float)*sz->w*sz->h);
-    assert(hist->bytes >= sizeof(cl_float8)*sz->w*sz->h);
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        yapd_cpu_pyramid_border(gpu, (float*)src->host, p->cell, sz, &pad);
+        if (packed) {
+            pack_cpu(p, dst, (float*)src->host, (int)(size[0]*size[1]));
+        }
+        return;
+    }
 
-    err = clSetKernelArg(c->pyramid_conpad, 0, sizeof(cl_mem), &dst->mem);
+    k = conpad_kernel(gpu, &pad, p->opts.compact, storage, CONPAD_BORDER);
+    err = clSetKernelArg(k, 0, sizeof(cl_mem), &dst->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->pyramid_conpad, 1, sizeof(cl_int2), sz);
+    err = clSetKernelArg(k, 1, sizeof(cl_int2), sz);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->pyramid_conpad, 2, sizeof(cl_int2), &pad);
+    err = clSetKernelArg(k, 2, sizeof(cl_int2), &pad);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->pyramid_conpad, 3, sizeof(cl_mem), &color->mem);
+    err = clSetKernelArg(k, 3, sizeof(cl_mem), &src->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->pyramid_conpad, 4, sizeof(cl_mem), &mag->mem);
+    set_quant(p, k, 4);
+
+    err = clEnqueueNDRangeKernel(
+        gpu->queue, k, 2, offset, size, NULL, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(c->pyramid_conpad, 5, sizeof(cl_mem), &hist->mem);
+}
+
+// approximated levels `first` to `first + n` of real scale features `src`
+// (float cells before smoothing), into `dst` slots of pyramid.
+static void
+approx(
+    yapd_pyramid_t* p, yapd_buffer_t* src,
+    yapd_buffer_t** dst, int first, int n)
+{
+    int i;
+    cl_int err;
+    cl_kernel k;
+    yapd_gpu_t* gpu = p->gpu;
+    const int storage = p->opts.storage;
+    const int packed = storage != YAPD_FEATURE_FLOAT;
+    const int shrink = p->channels->opts.shrink;
+    const yapd_pyramid_level_t* lvs = p->levels_host + first;
+    const yapd_size_t pad = {
+        p->opts.pad.w / shrink,
+        p->opts.pad.h / shrink
+    };
+    size_t offset[] = { 0, 0, 0 };
+    size_t size[] = { 0, 0, n };
+
+    assert(n > 0 && n <= YAPD_PYRAMID_MAX_APPROX_LAUNCH);
+
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        for (i = 0; i < n; ++i) {
+            const int src_w = lvs[i].src_sz.s[0] + 2*pad.w;
+            const int num =
+                (lvs[i].sz.s[0] + 2*pad.w)*(lvs[i].sz.s[1] + 2*pad.h);
+            yapd_buffer_t* o = packed ? &p->tmp : dst[i];
+            if (packed) {
+                yapd_buffer_reserve(&p->tmp, sizeof(float)*p->cell*num);
+            }
+            yapd_cpu_pyramid_approx(
+                gpu, (float*)o->host, p->cell, lvs + i, &pad,
+                (float*)src->host + (pad.h*src_w + pad.w)*p->cell);
+            if (packed) pack_cpu(p, dst[i], (float*)o->host, num);
+        }
+        return;
+    }
+
+    k = conpad_kernel(gpu, &pad, p->opts.compact, storage, CONPAD_APPROX);
+    for (i = 0; i < YAPD_PYRAMID_MAX_APPROX_LAUNCH; ++i) {
+        // unused slots point to the first level
+        const yapd_buffer_t* d = dst[i < n ? i : 0];
+        err = clSetKernelArg(k, i, sizeof(cl_mem), &d->mem);
+        assert(err == CL_SUCCESS);
+    }
+    for (i = 0; i < n; ++i) {
+        size[0] = YAPD_MAX(size[0], (size_t)(lvs[i].sz.s[0] + 2*pad.w));
+        size[1] = YAPD_MAX(size[1], (size_t)(lvs[i].sz.s[1] + 2*pad.h));
+    }
+    i = YAPD_PYRAMID_MAX_APPROX_LAUNCH;
+    err = clSetKernelArg(k, i++, sizeof(cl_int2), &pad);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, i++, sizeof(cl_mem), &p->levels.mem);
     assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, i++, sizeof(int), &first);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, i++, sizeof(cl_mem), &src->mem);
+    assert(err == CL_SUCCESS);
+    set_quant(p, k, i++);
 
     err = clEnqueueNDRangeKernel(
-        gpu->queue, c->pyramid_conpad, 2, offset, size, NULL, 0, NULL, NULL);
+        gpu->queue, k, 3, offset, size, NULL, 0, NULL, NULL);
     assert(err == CL_SUCCESS);
 }
 
+// packed slots at scale `i` smoothed by pyramid_smooth_cols/rows,
+// natively by float convolution of `work` (free after approximations).
+static void
+smooth_packed(
+    yapd_pyramid_t* p, int i)
+{
+    cl_int err;
+    cl_kernel k;
+    int j;
+    yapd_gpu_t* gpu = p->gpu;
+    const yapd_size_t* sz = p->data_sz + i;
+    const int num = sz->w*sz->h;
+    const int shrink = p->channels->opts.shrink;
+    const yapd_size_t pad = {
+        p->opts.pad.w / shrink,
+        p->opts.pad.h / shrink
+    };
+    size_t offset[] = { 0, 0, 0 };
+    size_t size[] = { sz->w, sz->h, 1 };
+
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        float q[YAPD_FEATURE_CHANNELS];
+        lane_quant(p, q);
+        yapd_buffer_reserve(&p->work, sizeof(float)*p->cell*num);
+        yapd_cpu_pyramid_unpack(
+            gpu, (float*)p->work.host, p->opts.storage, p->data[i].host,
+            p->cell, q, num);
+        if (p->opts.compact) {
+            yapd_buffer_conv_tri32fc10(
+                &p->work, &p->tmp, sz, p->opts.smooth, &p->smooth_filter);
+        } else {
+            yapd_buffer_conv_tri32fc16(
+                &p->work, &p->tmp, sz, p->opts.smooth, &p->smooth_filter);
+        }
+        pack_cpu(p, p->data + i, (float*)p->work.host, num);
+        return;
+    }
+
+    for (j = 0; j < 2; ++j) {
+        const int kernel = j == 0 ? CONPAD_SMOOTH_COLS : CONPAD_SMOOTH_ROWS;
+        yapd_buffer_t* dst = j == 0 ? &p->tmp : p->data + i;
+        yapd_buffer_t* src = j == 0 ? p->data + i : &p->tmp;
+        k = conpad_kernel(
+            gpu, &pad, p->opts.compact, p->opts.storage, kernel);
+        err = clSetKernelArg(k, 0, sizeof(cl_mem), &dst->mem);
+        assert(err == CL_SUCCESS);
+        err = clSetKernelArg(k, 1, sizeof(cl_int2), sz);
+        assert(err == CL_SUCCESS);
+        err = clSetKernelArg(k, 2, sizeof(int), &p->opts.smooth);
+        assert(err == CL_SUCCESS);
+        err = clSetKernelArg(k, 3, sizeof(cl_mem), &p->smooth_filter.mem);
+        assert(err == CL_SUCCESS);
+        err = clSetKernelArg(k, 4, sizeof(cl_mem), &src->mem);
+        assert(err == CL_SUCCESS);
+        set_quant(p, k, 5);
+        err = clEnqueueNDRangeKernel(
+            gpu->queue, k, 2, offset, size, NULL, 0, NULL, NULL);
+        assert(err == CL_SUCCESS);
+    }
+}
+
+// optional smoothing of padded features at scale `i`.
+static void
+smooth(
+    yapd_pyramid_t* p, int i)
+{
+    if (p->opts.smooth <= 0) return;
+    yapd_buffer_reserve(
+        &p->tmp, sizeof(float)*p->cell*p->data_sz[i].w*p->data_sz[i].h);
+    if (p->opts.storage != YAPD_FEATURE_FLOAT) {
+        smooth_packed(p, i);
+        return;
+    }
+    if (p->opts.compact) {
+        yapd_buffer_conv_tri32fc10(
+            p->data + i, &p->tmp, p->data_sz + i,
+            p->opts.smooth, &p->smooth_filter);
+        return;
+    }
+    YAPD_STATIC_ASSERT(sizeof(yapd_feature_t) == sizeof(cl_float16));
+    yapd_buffer_conv_tri32fc16(
+        p->data + i, &p->tmp, p->data_sz + i,
+        p->opts.smooth, &p->smooth_filter);
+}
+
 static const yapd_pyramid_opts_t default_opts = {
     .pad = { 0, 0 },
     .min_ds = { 16, 16 },
     .num_approx = 0,
     .per_oct = 8,
     .oct_up = 0,
-    .smooth = 0
+    .smooth = 0,
+    .cascade = 0,
+    .compact = 0,
+    .storage = YAPD_FEATURE_FLOAT,
+    .quant = { 255.0f, 160.0f, 200.0f }
 };
 
 void
@@ -236,8 +576,10 @@ yapd_gpu_setup_pyramid(
 {
     cl_int err;
     yapd_gpu_pyramid_ctx_t* p = &gpu->pyramid;
-    p->program = yapd_gpu_load_program(gpu, pyramid_cl);
-    p->pyramid_conpad = clCreateKernel(p->program, "pyramid_conpad", &err);
+    p->program = yapd_gpu_load_program(gpu, pyramid_cl, NULL);
+    p->pyramid_border = clCreateKernel(p->program, "pyramid_border", &err);
+    assert(err == CL_SUCCESS);
+    p->pyramid_approx = clCreateKernel(p->program, "pyramid_approx", &err);
     assert(err == CL_SUCCESS);
 }
 
@@ -245,9 +587,19 @@ void
 yapd_gpu_release_pyramid(
     yapd_gpu_t* gpu)
 {
+    int i;
     yapd_gpu_pyramid_ctx_t* p = &gpu->pyramid;
-    clReleaseKernel(p->pyramid_conpad);
+    clReleaseKernel(p->pyramid_border);
+    clReleaseKernel(p->pyramid_approx);
     clReleaseProgram(p->program);
+    for (i = 0; i < p->num_variants; ++i) {
+        clReleaseKernel(p->variants[i].pyramid_border);
+        clReleaseKernel(p->variants[i].pyramid_approx);
+        clReleaseKernel(p->variants[i].pyramid_smooth_cols);
+        clReleaseKernel(p->variants[i].pyramid_smooth_rows);
+        clReleaseProgram(p->variants[i].program);
+    }
+    p->num_variants = 0;
 }
 
 const yapd_pyramid_opts_t*
@@ -270,6 +622,11 @@ yapd_pyramid_new(
     p.channels = channels;
     if (!opts) opts = &default_opts;
     p.opts = *opts;
+    p.cell = YAPD_FEATURE_CHANNELS;
+    if (p.opts.compact) {
+        assert(channels->opts.grad_hist.num_orients == 6);
+        p.cell = YAPD_FEATURE_COMPACT_CHANNELS;
+    }
 
     p.last_sz.w = 0;
     p.last_sz.h = 0;
@@ -279,16 +636,16 @@ yapd_pyramid_new(
     p.scalesw = NULL;
     p.scalesh = NULL;
     p.data_sz = NULL;
+    p.slot_off = NULL;
     p.data = NULL;
+    p.slots = yapd_buffer_create(gpu, 0);
+    p.levels_host = NULL;
     p.tmp = yapd_buffer_create(gpu, 0);
     p.img = yapd_buffer_create(gpu, 0);
-    p.small = yapd_buffer_create(gpu, 0);
-    p.color = yapd_buffer_create(gpu, 0);
-    p.mag = yapd_buffer_create(gpu, 0);
-    p.hist = yapd_buffer_create(gpu, 0);
-    p.apx_color = yapd_buffer_create(gpu, 0);
-    p.apx_mag = yapd_buffer_create(gpu, 0);
-    p.apx_hist = yapd_buffer_create(gpu, 0);
+    p.base = yapd_buffer_create(gpu, 0);
+    p.rgb = yapd_buffer_create(gpu, 0);
+    p.work = yapd_buffer_create(gpu, 0);
+    p.levels = yapd_buffer_readonly(gpu, 0);
 
     assert(p.opts.num_approx == -1 || p.opts.num_approx >= 0);
     if (p.opts.num_approx == -1) {
@@ -316,12 +673,10 @@ yapd_pyramid_release(
 
     yapd_buffer_release(&p->tmp);
     yapd_buffer_release(&p->img);
-    yapd_buffer_release(&p->color);
-    yapd_buffer_release(&p->mag);
-    yapd_buffer_release(&p->hist);
-    yapd_buffer_release(&p->apx_color);
-    yapd_buffer_release(&p->apx_mag);
-    yapd_buffer_release(&p->apx_hist);
+    yapd_buffer_release(&p->base);
+    yapd_buffer_release(&p->rgb);
+    yapd_buffer_release(&p->work);
+    yapd_buffer_release(&p->levels);
     if (p->cap_scales > 0) {
         p->a.dealloc(p->aud, p->approxes);
         p->approxes = NULL;
@@ -333,6 +688,10 @@ yapd_pyramid_release(
         p->scalesh = NULL;
         p->a.dealloc(p->aud, p->data_sz);
         p->data_sz = NULL;
+        p->a.dealloc(p->aud, p->slot_off);
+        p->slot_off = NULL;
+        p->a.dealloc(p->aud, p->levels_host);
+        p->levels_host = NULL;
         for (i = 0; i < p->cap_scales; ++i) {
             yapd_buffer_release(p->data + i);
         }
@@ -340,6 +699,31 @@ yapd_pyramid_release(
         p->data = NULL;
         p->cap_scales = 0;
     }
+    yapd_buffer_release(&p->slots);
+}
+
+// places padded slots of all scales in a single buffer, so that the
+// detector covers every scale by a single launch.
+static void
+layout_slots(
+    yapd_pyramid_t* p, int pad_w, int pad_h)
+{
+    int i, bytes = 0;
+    const int align = yapd_buffer_align(p->gpu);
+    for (i = 0; i < p->num_scales; ++i) {
+        const int w = p->data_sz[i].w + pad_w;
+        const int h = p->data_sz[i].h + pad_h;
+        yapd_buffer_release(p->data + i);
+        p->slot_off[i] = bytes;
+        bytes += (cell_bytes(p)*w*h + align - 1) / align * align;
+    }
+    yapd_buffer_reserve(&p->slots, bytes);
+    for (i = 0; i < p->num_scales; ++i) {
+        const int w = p->data_sz[i].w + pad_w;
+        const int h = p->data_sz[i].h + pad_h;
+        p->data[i] = yapd_buffer_sub(
+            &p->slots, p->slot_off[i], cell_bytes(p)*w*h);
+    }
 }
 
 void
@@ -347,10 +731,13 @@ yapd_pyramid_compute(
     yapd_pyramid_t* p, const yapd_mat_t* img,
     float lambda_color, float lambda_mag, float lambda_hist)
 {
-    int i, lr = -1;
-    yapd_buffer_t *color, *mag, *hist;
-    yapd_size_t small_sz, lr_sz, pad_sz;
+    int i, j, n, next, num_levels = 0, plan = FALSE;
+    yapd_size_t pad_sz;
+    yapd_buffer_t *src, *dst[YAPD_PYRAMID_MAX_APPROX_LAUNCH];
     const int shrink = p->channels->opts.shrink;
+    const int pad_w = (p->opts.pad.w / shrink) * 2;
+    const int pad_h = (p->opts.pad.h / shrink) * 2;
+    const int packed = p->opts.storage != YAPD_FEATURE_FLOAT;
     assert(img->size.w > 0 && img->size.h > 0 && img->type == YAPD_8UC4);
     fesetround(FE_TONEAREST);
     // prepare resources
@@ -358,73 +745,91 @@ yapd_pyramid_compute(
         get_scales(p, img->size.w, img->size.h);
         reserve_buffers(p, img->size.w, img->size.h);
         p->last_sz = img->size;
+        plan = TRUE;
+    }
+    // data sizes, and approximated levels grouped by real scale
+    for (i = 0; i < p->num_scales; ++i) {
+        const float s = p->scales[i];
+        p->data_sz[i].w = (int)rintf(img->size.w*s / shrink);
+        p->data_sz[i].h = (int)rintf(img->size.h*s / shrink);
     }
-    // convert color
+    for (i = 0; i < p->num_scales; ++i) {
+        if (p->approxes[i] != APX_REAL) continue;
+        for (j = 0; j < p->num_scales; ++j) {
+            yapd_pyramid_level_t* lv = p->levels_host + num_levels;
+            const float r = p->scales[j] / p->scales[i];
+            if (p->approxes[j] != i) continue;
+            lv->ratio.s[0] = powf(r, -lambda_color);
+            lv->ratio.s[1] = powf(r, -lambda_mag);
+            lv->ratio.s[2] = powf(r, -lambda_hist);
+            lv->ratio.s[3] = 1.0f;
+            lv->sz.s[0] = p->data_sz[j].w;
+            lv->sz.s[1] = p->data_sz[j].h;
+            lv->src_sz.s[0] = p->data_sz[i].w;
+            lv->src_sz.s[1] = p->data_sz[i].h;
+            ++num_levels;
+        }
+    }
+    yapd_buffer_reserve(
+        &p->levels, sizeof(yapd_pyramid_level_t)*p->num_scales);
+    yapd_buffer_upload(
+        &p->levels, (uint8_t*)p->levels_host,
+        sizeof(yapd_pyramid_level_t)*num_levels);
+    if (plan) layout_slots(p, pad_w, pad_h);
+    for (i = 0; i < p->num_scales; ++i) {
+        pad_sz.w = p->data_sz[i].w + pad_w;
+        pad_sz.h = p->data_sz[i].h + pad_h;
+        if (packed) {
+            if (i > 0) continue;
+            // channels of all real scales, the first is the largest
+            yapd_buffer_reserve(
+                &p->work, sizeof(float)*p->cell*pad_sz.w*pad_sz.h);
+            if (plan && !p->opts.compact) yapd_buffer_zero(&p->work);
+            continue;
+        }
+        // unused lanes of float16 cells of real scales are never written
+        if (plan && !p->opts.compact && p->approxes[i] == APX_REAL) {
+            yapd_buffer_zero(p->data + i);
+        }
+    }
+    // upload source pixels
     yapd_buffer_upload_2d(
-        &p->tmp, img->data, sizeof(cl_uchar4)*img->size.w*img->size.h,
+        &p->rgb, img->data, sizeof(cl_uchar4)*img->size.w*img->size.h,
         &img->size, sizeof(cl_uchar4)*img->size.w);
-    yapd_buffer_luv_from_rgb8uc4(
-        &p->img, &p->tmp, &img->size);
     // compute pyramid
+    num_levels = 0;
     for (i = 0; i < p->num_scales; ++i) {
-        const float s = p->scales[i];
-        if (p->approxes[i] == APX_REAL) {
-            if (lr != i) {
-                compute_real(p, &img->size, s);
-                p->data_sz[i] = p->channels->data_sz;
-                lr_sz = p->channels->data_sz;
-                lr = i;
-            }
-            color = &p->color;
-            mag = &p->mag;
-            hist = &p->hist;
-        } else { // approximated
-            int small_totals;
-            const int real = p->approxes[i];
-            float ratio, rs = p->scales[real];
-            small_sz.w = (int)rintf(img->size.w*s / shrink);
-            small_sz.h = (int)rintf(img->size.h*s / shrink);
-            small_totals = small_sz.w*small_sz.h;
-            if (lr != real) {
-                compute_real(p, &img->size, p->scales[real]);
-                p->data_sz[real] = p->channels->data_sz;
-                lr_sz = p->channels->data_sz;
-                lr = real;
+        if (p->approxes[i] != APX_REAL) continue;
+        for (next = i + 1; next < p->num_scales; ++next) {
+            if (p->approxes[next] == APX_REAL) break;
+        }
+        if (next == p->num_scales) next = -1;
+        compute_real(p, &img->size, i, next);
+        assert(yapd_size_equals(&p->channels->data_sz, p->data_sz + i));
+        border(p, i);
+        p->data_sz[i].w += pad_w;
+        p->data_sz[i].h += pad_h;
+        // approximated levels, padded directly into their slots
+        src = packed ? &p->work : p->data + i;
+        for (j = 0, n = 0; j < p->num_scales; ++j) {
+            if (p->approxes[j] != i) continue;
+            dst[n++] = p->data + j;
+            p->data_sz[j].w += pad_w;
+            p->data_sz[j].h += pad_h;
+            if (n == YAPD_PYRAMID_MAX_APPROX_LAUNCH) {
+                approx(p, src, dst, num_levels, n);
+                num_levels += n;
+                n = 0;
             }
-            p->data_sz[i] = small_sz;
-            ratio = powf(s / rs, -lambda_color);
-            yapd_buffer_reserve(
-                &p->apx_color, sizeof(cl_float4)*small_totals);
-            yapd_buffer_resample32fc4(
-                &p->apx_color, &small_sz, &p->color, &lr_sz, ratio);
-            ratio = powf(s / rs, -lambda_mag);
-            yapd_buffer_reserve(
-                &p->apx_mag, sizeof(float)*small_totals);
-            yapd_buffer_resample32f(
-                &p->apx_mag, &small_sz, &p->mag, &lr_sz, ratio);
-            ratio = powf(s / rs, -lambda_hist);
-            yapd_buffer_reserve(
-                &p->apx_hist, sizeof(cl_float8)*small_totals);
-            yapd_buffer_resample32fc8(
-                &p->apx_hist, &small_sz, &p->hist, &lr_sz , ratio);
-            color = &p->apx_color;
-            mag = &p->apx_mag;
-            hist = &p->apx_hist;
         }
-        // concat and pad to single float16 vector
-        pad_sz.w = p->data_sz[i].w + (p->opts.pad.w / shrink) * 2;
-        pad_sz.h = p->data_sz[i].h + (p->opts.pad.h / shrink) * 2;
-        yapd_buffer_reserve(
-            p->data + i, sizeof(yapd_feature_t)*pad_sz.w*pad_sz.h);
-        conpad(p->data + i, p->data_sz + i, &pad_sz, color, mag, hist);
-        if (p->opts.smooth > 0) {
-            yapd_buffer_reserve(
-                &p->tmp, sizeof(yapd_feature_t)*pad_sz.w*pad_sz.h);
-            YAPD_STATIC_ASSERT(sizeof(yapd_feature_t) == sizeof(cl_float16));
-            yapd_buffer_conv_tri32fc16(
-                p->data + i, &p->tmp, &pad_sz,
-                p->opts.smooth, &p->smooth_filter);
+        if (n > 0) {
+            approx(p, src, dst, num_levels, n);
+            num_levels += n;
+        }
+        // approximations are made of features before smoothing
+        smooth(p, i);
+        for (j = 0; j < p->num_scales; ++j) {
+            if (p->approxes[j] == i) smooth(p, j);
         }
-        p->data_sz[i] = pad_sz;
     }
-}
\ No newline at end of file
+}
@@ -2,32 +2,50 @@
 #include <yapd/buffer.h>
 
 #include <yapd/gpu.h>
+#include <cpu/cpu.h>
 #include <resample.cl.h>
 
 static void
 resample32f(
     int pixel_sz, cl_kernel kernel,
-    yapd_buffer_t* dst, const yapd_size_t* dst_sz,
+    const yapd_buffer_view_t* dst, const yapd_size_t* dst_sz,
     yapd_buffer_t* src, const yapd_size_t* src_sz, float norm)
 {
     cl_int err;
-    yapd_gpu_t* gpu = dst->gpu;
+    yapd_gpu_t* gpu = dst->buf->gpu;
     size_t offset[] = { 0, 0, 0 };
     size_t size[] = { dst_sz->w, dst_sz->h, 1 };
+    const cl_int4 view = {{ dst->pitch, dst->offset, dst->cell, dst->lane }};
+    const int channels = pixel_sz / sizeof(float);
 
     assert(gpu == src->gpu);
-    assert(dst->bytes >= pixel_sz * dst_sz->w*dst_sz->h);
+    // float8 into compact feature cells keeps 6 orientations
+    assert(dst->lane + channels <= dst->cell ||
+        (channels == 8 && dst->lane + 6 == dst->cell));
+    assert(dst->buf->bytes >= sizeof(float)*dst->cell*
+        (dst->offset + (dst_sz->h - 1)*dst->pitch + dst_sz->w));
     assert(src->bytes >= pixel_sz * src_sz->w*src_sz->h);
 
-    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &dst->mem);
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        yapd_cpu_resample(
+            gpu, channels, YAPD_MIN(channels, dst->cell - dst->lane),
+            (float*)dst->buf->host + dst->offset*dst->cell + dst->lane,
+            dst->pitch*dst->cell, dst->cell, dst_sz,
+            (float*)src->host, src_sz, norm);
+        return;
+    }
+
+    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &dst->buf->mem);
     assert(err == CL_SUCCESS);
     err = clSetKernelArg(kernel, 1, sizeof(cl_int2), dst_sz);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(kernel, 2, sizeof(cl_mem), &src->mem);
+    err = clSetKernelArg(kernel, 2, sizeof(cl_int4), &view);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(kernel, 3, sizeof(cl_int2), src_sz);
+    err = clSetKernelArg(kernel, 3, sizeof(cl_mem), &src->mem);
     assert(err == CL_SUCCESS);
-    err = clSetKernelArg(kernel, 4, sizeof(float), &norm);
+    err = clSetKernelArg(kernel, 4, sizeof(cl_int2), src_sz);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(kernel, 5, sizeof(float), &norm);
     assert(err == CL_SUCCESS);
 
     err = clEnqueueNDRangeKernel(
@@ -41,13 +59,15 @@ yapd_gpu_setup_resample(
 {
     cl_int err;
     yapd_gpu_resample_ctx_t* c = &gpu->resample;
-    c->program = yapd_gpu_load_program(gpu, resample_cl);
+    c->program = yapd_gpu_load_program(gpu, resample_cl, NULL);
     c->resample32f = clCreateKernel(c->program, "resample32f", &err);
     assert(err == CL_SUCCESS);
     c->resample32fc4 = clCreateKernel(c->program, "resample32fc4", &err);
     assert(err == CL_SUCCESS);
     c->resample32fc8 = clCreateKernel(c->program, "resample32fc8", &err);
     assert(err == CL_SUCCESS);
+    c->downsample32fc4 = clCreateKernel(c->program, "downsample32fc4", &err);
+    assert(err == CL_SUCCESS);
 }
 
 void
@@ -58,6 +78,7 @@ yapd_gpu_release_resample(
     clReleaseKernel(c->resample32f);
     clReleaseKernel(c->resample32fc4);
     clReleaseKernel(c->resample32fc8);
+    clReleaseKernel(c->downsample32fc4);
     clReleaseProgram(c->program);
 }
 
@@ -66,8 +87,19 @@ yapd_buffer_resample32f(
     yapd_buffer_t* dst, const yapd_size_t* dst_sz,
     yapd_buffer_t* src, const yapd_size_t* src_sz, float norm)
 {
+    const yapd_buffer_view_t view = yapd_buffer_view(dst, dst_sz->w, 1);
     resample32f(
         sizeof(float), dst->gpu->resample.resample32f,
+        &view, dst_sz, src, src_sz, norm);
+}
+
+void
+yapd_buffer_resample32f_view(
+    const yapd_buffer_view_t* dst, const yapd_size_t* dst_sz,
+    yapd_buffer_t* src, const yapd_size_t* src_sz, float norm)
+{
+    resample32f(
+        sizeof(float), dst->buf->gpu->resample.resample32f,
         dst, dst_sz, src, src_sz, norm);
 }
 
@@ -76,8 +108,19 @@ yapd_buffer_resample32fc4(
     yapd_buffer_t* dst, const yapd_size_t* dst_sz,
     yapd_buffer_t* src, const yapd_size_t* src_sz, float norm)
 {
+    const yapd_buffer_view_t view = yapd_buffer_view(dst, dst_sz->w, 4);
     resample32f(
         sizeof(cl_float4), dst->gpu->resample.resample32fc4,
+        &view, dst_sz, src, src_sz, norm);
+}
+
+void
+yapd_buffer_resample32fc4_view(
+    const yapd_buffer_view_t* dst, const yapd_size_t* dst_sz,
+    yapd_buffer_t* src, const yapd_size_t* src_sz, float norm)
+{
+    resample32f(
+        sizeof(cl_float4), dst->buf->gpu->resample.resample32fc4,
         dst, dst_sz, src, src_sz, norm);
 }
 
@@ -86,7 +129,53 @@ yapd_buffer_resample32fc8(
     yapd_buffer_t* dst, const yapd_size_t* dst_sz,
     yapd_buffer_t* src, const yapd_size_t* src_sz, float norm)
 {
+    const yapd_buffer_view_t view = yapd_buffer_view(dst, dst_sz->w, 8);
     resample32f(
         sizeof(cl_float8), dst->gpu->resample.resample32fc8,
+        &view, dst_sz, src, src_sz, norm);
+}
+
+void
+yapd_buffer_resample32fc8_view(
+    const yapd_buffer_view_t* dst, const yapd_size_t* dst_sz,
+    yapd_buffer_t* src, const yapd_size_t* src_sz, float norm)
+{
+    resample32f(
+        sizeof(cl_float8), dst->buf->gpu->resample.resample32fc8,
         dst, dst_sz, src, src_sz, norm);
-}
\ No newline at end of file
+}
+
+void
+yapd_buffer_downsample32fc4(
+    yapd_buffer_t* dst, const yapd_size_t* dst_sz,
+    yapd_buffer_t* src, const yapd_size_t* src_sz)
+{
+    cl_int err;
+    yapd_gpu_t* gpu = dst->gpu;
+    size_t offset[] = { 0, 0, 0 };
+    size_t size[] = { dst_sz->w, dst_sz->h, 1 };
+    cl_kernel k = gpu->resample.downsample32fc4;
+
+    assert(gpu == src->gpu);
+    assert(dst->bytes >= sizeof(cl_float4)*dst_sz->w*dst_sz->h);
+    assert(src->bytes >= sizeof(cl_float4)*src_sz->w*src_sz->h);
+
+    if (gpu->backend == YAPD_BACKEND_CPU) {
+        yapd_cpu_downsample(
+            gpu, 4, (float*)dst->host, dst_sz, (float*)src->host, src_sz);
+        return;
+    }
+
+    err = clSetKernelArg(k, 0, sizeof(cl_mem), &dst->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 1, sizeof(cl_int2), dst_sz);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 2, sizeof(cl_mem), &src->mem);
+    assert(err == CL_SUCCESS);
+    err = clSetKernelArg(k, 3, sizeof(cl_int2), src_sz);
+    assert(err == CL_SUCCESS);
+
+    err = clEnqueueNDRangeKernel(
+        gpu->queue, k, 2, offset, size, NULL, 0, NULL, NULL);
+    assert(err == CL_SUCCESS);
+}
@@ -16,6 +16,7 @@
 #include <thread>
 #include <chrono>
 #include <stdarg.h>
+#include <limits.h>
 #include <numeric>
 #include <algorithm>
 
@@ -286,6 +287,21 @@ query_int(
 #define BAD_IFN(exp) if (!(exp)) { r = simple_response(con, 400); break; }
 #define CONFLICT_IFN(exp) if (!(exp)) { r = simple_response(con, 409); break; }
 
+// optional coarse-to-fine search of a request, set on every request so
+// that it never carries over to the next one.
+static bool
+query_coarse(
+    struct wby_con* con, yapd_detector_t& d, float casc_thr)
+{
+    int coarse = 0;
+    float coarse_thr = casc_thr;
+    query_int(con, "coarse", coarse);
+    query_float(con, "coarse_thr", coarse_thr);
+    if (coarse < 0) return false;
+    yapd_detector_coarse(&d, coarse, coarse_thr);
+    return true;
+}
+
 static int
 handle_stop(
     servo_t& sv, struct wby_con* con)
@@ -454,10 +470,13 @@ handle_classifier(
         cmp_ctx_t in;
         cmp_init(&in, con, &wby_reader, NULL, NULL);
         char key[256];
-        uint32_t map_sz, bin_sz;
+        uint32_t map_sz, bin_sz, num_stages = 0;
         int64_t win_sz_w, win_sz_h;
         int64_t org_win_w, org_win_h;
         int64_t num_weaks, depth, shrink;
+        int stages[YAPD_DETECTOR_MAX_STAGES];
+        // checked after the key loop, which a BAD_IFN only leaves
+        bool stages_ok = true;
         yapd_mat_t thrs = yapd_mat_new(
             sv.ascratch.aif, &sv.ascratch);
         yapd_mat_t hs = yapd_mat_new(
@@ -512,20 +531,38 @@ handle_classifier(
                         cmp_read_bin_size(&in, &bin_sz) &&
                         read(con, bin_sz, hs) &&
                         hs.type == YAPD_32F);
+                } else if (strcmp(key, "stages") == 0) {
+                    // ends of trees of each stage but the last one
+                    stages_ok =
+                        cmp_read_array(&in, &num_stages) &&
+                        num_stages < YAPD_DETECTOR_MAX_STAGES;
+                    for (uint32_t j = 0; stages_ok && j < num_stages; ++j) {
+                        int64_t end;
+                        stages_ok = cmp_read_integer(&in, &end) &&
+                            end > (j ? stages[j - 1] : 0) &&
+                            end <= INT_MAX;
+                        if (stages_ok) stages[j] = (int)end;
+                    }
+                    if (!stages_ok) break;
                 }
             }
+            BAD_IFN(stages_ok);
             BAD_IFN(
                 thrs.size.h == num_weaks &&
                 thrs.size.w == YAPD_DETECTOR_TREE_NODES &&
                 fids.size.h == num_weaks &&
                 fids.size.w == YAPD_DETECTOR_TREE_NODES &&
                 hs.size.h == num_weaks &&
-                hs.size.w == YAPD_DETECTOR_TREE_NODES);
+                hs.size.w == YAPD_DETECTOR_TREE_NODES &&
+                (num_stages == 0 ||
+                 (stages[0] <= YAPD_DETECTOR_EARLY_WEAKS &&
+                  stages[num_stages - 1] < num_weaks)));
             const yapd_size_t win_sz = { (int)win_sz_w, (int)win_sz_h };
             const yapd_size_t org_win = { (int)org_win_w, (int)org_win_h };
             yapd_detector_classifier(
                 &sv.detector, TRUE, (int)num_weaks, (int)depth,
-                (int)shrink, &win_sz, &org_win, &thrs, &fids, &hs);
+                (int)shrink, &win_sz, &org_win, &thrs, &fids, &hs,
+                stages, (int)num_stages);
             r = simple_response(con, 204);
         } while (FALSE);
         yapd_mat_release(&thrs);
@@ -538,7 +575,7 @@ handle_classifier(
         cmp_ctx_t cmp;
         cmp_init(&cmp, con, NULL, NULL, &wby_writer);
         msgp_response_begin(con, 200, -1);
-        cmp_write_map(&cmp, 10);
+        cmp_write_map(&cmp, 11);
         write(cmp, "num_weaks");
         cmp_write_integer(&cmp, d.num_weaks);
         write(cmp, "depth");
@@ -553,6 +590,11 @@ handle_classifier(
         cmp_write_integer(&cmp, d.org_win.w);
         write(cmp, "org_win_h");
         cmp_write_integer(&cmp, d.org_win.h);
+        write(cmp, "stages");
+        cmp_write_array(&cmp, (uint32_t)std::max(d.num_stages - 1, 0));
+        for (int i = 0; i < d.num_stages - 1; ++i) {
+            cmp_write_integer(&cmp, d.stages[i]);
+        }
         write(cmp, "thrs");
         write_buf(
             sv.ascratch.aif, &sv.ascratch, YAPD_32F,
@@ -594,6 +636,7 @@ handle_detect(
                 query_float(con, "lambda_hist", lambda_hist));
             yapd_detector_t& d = sv.detector;
             CONFLICT_IFN(yapd_detector_ready(&d));
+            BAD_IFN(query_coarse(con, d, casc_thr));
             yapd_pyramid_t& p = sv.pyramid;
             yapd_pyramid_compute(
                 &p, &src, lambda_color, lambda_mag, lambda_hist);
@@ -638,6 +681,7 @@ handle_benchmark(
                 query_float(con, "lambda_hist", lambda_hist));
             yapd_detector_t& d = sv.detector;
             CONFLICT_IFN(yapd_detector_ready(&d));
+            BAD_IFN(query_coarse(con, d, casc_thr));
             yapd_pyramid_t& p = sv.pyramid;
             auto t0 = chrono::high_resolution_clock::now();
             for (int i = 0; i < num_frames; ++i) {
@@ -682,6 +726,7 @@ handle_demo(
                 query_float(con, "lambda_hist", lambda_hist));
             yapd_detector_t& d = sv.detector;
             CONFLICT_IFN(yapd_detector_ready(&d));
+            BAD_IFN(query_coarse(con, d, casc_thr));
             r = simple_response(con, 204);
             yapd_pyramid_t& p = sv.pyramid;
             Mat f, rgba;
@@ -947,7 +992,19 @@ servo_init(
         error("failed to start webby server");
     }
 
-    self.gpu = yapd_gpu_new();
+    yapd_gpu_opts_t gpu_opts = *yapd_gpu_default_opts();
+    gpu_opts.cache_dir = ".";
+    self.gpu = yapd_gpu_new(&gpu_opts);
+    yapd_gpu_device_info_t dev_info;
+    if (yapd_gpu_device_info(&self.gpu, &dev_info)) {
+        char msg[512];
+        snprintf(
+            msg, sizeof(msg), "OpenCL device: %s, %s (%d compute units)",
+            dev_info.name, dev_info.platform_name, dev_info.compute_units);
+        log(msg);
+    } else {
+        log("OpenCL device: none, using native CPU backend");
+    }
     self.color = yapd_buffer_create(&self.gpu, 0);
     self.mag = yapd_buffer_create(&self.gpu, 0);
     self.hist = yapd_buffer_create(&self.gpu, 0);
@@ -970,6 +1027,7 @@ servo_init(
 
     self.detector = yapd_detector_new(
         self.amalloc.aif, &self.amalloc, &self.gpu);
+    yapd_detector_capacity(&self.detector, 4096);
 
 #if 0
     self.hogsvm.setSVMDetector(HOGDescriptor::getDefaultPeopleDetector());